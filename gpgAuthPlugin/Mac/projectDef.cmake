@@ -30,8 +30,15 @@ set(LOCALIZED "Mac/bundle_template/Localized.r")
 
 add_mac_plugin(${PROJECT_NAME} ${PLIST} ${STRINGS} ${LOCALIZED} SOURCES)
 
+# The batch operations call gpgme from several threads; use the thread safe
+# build of gpgme where one is available (see gpgme_max_workers)
 add_library(gpgme STATIC IMPORTED)
-set_property(TARGET gpgme PROPERTY IMPORTED_LOCATION ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpgme/Darwin_x86_64-gcc/libgpgme.a)
+IF(EXISTS ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpgme/Darwin_x86_64-gcc/libgpgme-pthread.a)
+    set_property(TARGET gpgme PROPERTY IMPORTED_LOCATION ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpgme/Darwin_x86_64-gcc/libgpgme-pthread.a)
+    add_definitions(-DHAVE_GPGME_PTHREAD)
+ELSE ()
+    set_property(TARGET gpgme PROPERTY IMPORTED_LOCATION ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpgme/Darwin_x86_64-gcc/libgpgme.a)
+ENDIF(EXISTS ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpgme/Darwin_x86_64-gcc/libgpgme-pthread.a)
 add_library(gpg-error STATIC IMPORTED)
 set_property(TARGET gpg-error PROPERTY IMPORTED_LOCATION ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpg-error/Darwin_x86_64-gcc/libgpg-error.a)
 add_library(assuan STATIC IMPORTED)
@@ -33,8 +33,15 @@ ELSE ()
     set(ARCH_DIR "Linux_x86-gcc")
 ENDIF(CMAKE_SYSTEM_PROCESSOR STREQUAL "x86_64")
 
+# The batch operations call gpgme from several threads; use the thread safe
+# build of gpgme where one is available (see gpgme_max_workers)
 add_library(gpgme STATIC IMPORTED)
-set_property(TARGET gpgme PROPERTY IMPORTED_LOCATION ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpgme/${ARCH_DIR}/libgpgme.a)
+IF(EXISTS ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpgme/${ARCH_DIR}/libgpgme-pthread.a)
+    set_property(TARGET gpgme PROPERTY IMPORTED_LOCATION ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpgme/${ARCH_DIR}/libgpgme-pthread.a)
+    add_definitions(-DHAVE_GPGME_PTHREAD)
+ELSE ()
+    set_property(TARGET gpgme PROPERTY IMPORTED_LOCATION ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpgme/${ARCH_DIR}/libgpgme.a)
+ENDIF(EXISTS ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpgme/${ARCH_DIR}/libgpgme-pthread.a)
 add_library(gpg-error STATIC IMPORTED)
 set_property(TARGET gpg-error PROPERTY IMPORTED_LOCATION ${CMAKE_CURRENT_SOURCE_DIR}/libs/libgpg-error/${ARCH_DIR}/libgpg-error.a)
 add_library(assuan STATIC IMPORTED)
@@ -46,6 +53,7 @@ target_link_libraries(${PROJECT_NAME}
     gpgme
     assuan
     gpg-error
+    pthread
     )
 
 set(PNAME "${FB_BUILD_DIR}/bin/${PROJECT_NAME}/np${PLUGIN_NAME}-v${FBSTRING_PLUGIN_VERSION}.so")
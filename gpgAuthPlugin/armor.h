@@ -0,0 +1,572 @@
+/**********************************************************\
+Original Author: Kyle L. Huff (kylehuff)
+
+Created:    Jan 14, 2011
+License:    GNU General Public License, version 2
+            http://www.gnu.org/licenses/gpl-2.0.html
+
+Copyright 2011 Kyle L. Huff, CURETHEITCH development team
+\**********************************************************/
+
+/*
+ * Native handling of OpenPGP ASCII armor (RFC 4880, sections 4.2 and 6).
+ *
+ * Nothing in here invokes gpg; the methods only locate armored blocks,
+ *  decode the radix-64 body, check the CRC24 and look at the leading
+ *  packet headers, which is enough to tell what kind of PGP data a block
+ *  contains and which keys it refers to.
+ */
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#ifndef H_gpgAuthPluginARMOR
+#define H_gpgAuthPluginARMOR
+
+// The location of an armored block inside of a larger text
+struct armor_block {
+    // offset of the first "-" of the BEGIN line
+    std::string::size_type begin;
+    // offset one past the last "-" of the END line
+    std::string::size_type end;
+    // The armor label, i.e. "MESSAGE", "SIGNED MESSAGE", "SIGNATURE"
+    std::string label;
+};
+
+// The result of classifying a single armored block
+struct armor_info {
+    // One of "encrypted_message", "signed_message", "detached_signature",
+    //  "compressed_message", "literal_message", "public_key_block",
+    //  "private_key_block" or "unknown"
+    std::string message_type;
+    std::string label;
+    bool clearsigned;
+    bool symmetric;
+    bool has_crc;
+    bool crc_valid;
+    // The packet tags found at the top level of the (first) armored section
+    std::vector<int> packet_tags;
+    // 16 character, uppercase key ids as gpgme reports them
+    std::vector<std::string> recipients;
+    std::vector<std::string> signers;
+    std::map<std::string, std::string> headers;
+};
+
+static const char armor_begin[] = "-----BEGIN PGP ";
+static const char armor_end[] = "-----END PGP ";
+static const char armor_dashes[] = "-----";
+
+/* Calculates the CRC24 checksum of the radix-64 decoded data */
+static unsigned long armor_crc24(const std::string& data)
+{
+    unsigned long crc = 0xB704CEL;
+    for (std::string::size_type i = 0; i < data.length(); i++) {
+        crc ^= ((unsigned long) (unsigned char) data[i]) << 16;
+        for (int b = 0; b < 8; b++) {
+            crc <<= 1;
+            if (crc & 0x1000000)
+                crc ^= 0x1864CFBL;
+        }
+    }
+    return crc & 0xFFFFFFL;
+}
+
+/* Returns the 6 bit value of a radix-64 character, or -1 */
+static int armor_b64_value(unsigned char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+/* Decodes radix-64 data into out, skipping whitespace; decoding stops at
+    the first pad character. Returns false on any other invalid character */
+static bool armor_b64_decode(const char *data, std::string::size_type len,
+    std::string& out)
+{
+    unsigned long acc = 0;
+    int bits = 0;
+
+    out.reserve(out.length() + (len / 4) * 3);
+    for (std::string::size_type i = 0; i < len; i++) {
+        unsigned char c = data[i];
+        if (c == '\r' || c == '\n' || c == ' ' || c == '\t')
+            continue;
+        if (c == '=')
+            break;
+        int v = armor_b64_value(c);
+        if (v < 0)
+            return false;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out += (char) ((acc >> bits) & 0xFF);
+        }
+    }
+    return true;
+}
+
+/* Encodes the binary data as radix-64, wrapped at line_len characters
+    (0 for no wrapping) */
+static std::string armor_b64_encode(const std::string& data, int line_len=0)
+{
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    int col = 0;
+
+    out.reserve(((data.length() + 2) / 3) * 4 + (line_len ? data.length() / line_len + 1 : 0));
+    for (std::string::size_type i = 0; i < data.length(); i += 3) {
+        unsigned long n = ((unsigned long) (unsigned char) data[i]) << 16;
+        std::string::size_type remain = data.length() - i;
+        if (remain > 1)
+            n |= ((unsigned long) (unsigned char) data[i + 1]) << 8;
+        if (remain > 2)
+            n |= (unsigned long) (unsigned char) data[i + 2];
+        out += alphabet[(n >> 18) & 0x3F];
+        out += alphabet[(n >> 12) & 0x3F];
+        out += remain > 1 ? alphabet[(n >> 6) & 0x3F] : '=';
+        out += remain > 2 ? alphabet[n & 0x3F] : '=';
+        col += 4;
+        if (line_len && col >= line_len && i + 3 < data.length()) {
+            out += '\n';
+            col = 0;
+        }
+    }
+    return out;
+}
+
+/* Returns the offset of the next line, or the length of text */
+static std::string::size_type armor_next_line(const std::string& text,
+    std::string::size_type pos, std::string::size_type limit)
+{
+    const char *nl = (const char *) memchr(text.data() + pos, '\n', limit - pos);
+    return nl ? (nl - text.data()) + 1 : limit;
+}
+
+/* Locates the next armored block at or after the offset from. The BEGIN
+    line is only accepted at the start of a line, and for a clearsigned
+    message the block extends to the END line of the trailing signature.
+    The candidate lines are located with memchr, so text without any
+    armor is skipped at memory scanning speed. */
+static bool armor_find_block(const std::string& text,
+    std::string::size_type from, armor_block& block)
+{
+    const std::string::size_type begin_len = sizeof(armor_begin) - 1;
+    const char *base = text.data();
+    std::string::size_type len = text.length();
+    std::string::size_type pos = from;
+
+    while (pos < len) {
+        const char *hit = (const char *) memchr(base + pos, '-', len - pos);
+        if (!hit)
+            return false;
+        pos = hit - base;
+
+        if ((pos == 0 || base[pos - 1] == '\n')
+            && len - pos > begin_len
+            && !memcmp(base + pos, armor_begin, begin_len)) {
+            std::string::size_type label_start = pos + begin_len;
+            std::string::size_type label_end = text.find(armor_dashes, label_start);
+            std::string::size_type eol = armor_next_line(text, label_start, len);
+            if (label_end != std::string::npos && label_end < eol) {
+                std::string label = text.substr(label_start, label_end - label_start);
+                std::string end_line = armor_end;
+                if (label == "SIGNED MESSAGE")
+                    end_line += "SIGNATURE";
+                else
+                    end_line += label;
+                end_line += armor_dashes;
+
+                std::string::size_type end = text.find(end_line, eol);
+                if (end == std::string::npos) {
+                    // Truncated block; keep looking for others
+                    pos = eol;
+                    continue;
+                }
+
+                block.begin = pos;
+                block.end = end + end_line.length();
+                block.label = label;
+                return true;
+            }
+        }
+
+        // Skip the remainder of this run of dashes
+        while (pos < len && base[pos] == '-')
+            pos++;
+    }
+
+    return false;
+}
+
+/* Decodes the armored section starting with the BEGIN line at offset
+    begin (and ending at limit) into its binary form; the armor headers
+    are collected in info. Returns false if the body is not valid
+    radix-64 */
+static bool armor_decode(const std::string& text, std::string::size_type begin,
+    std::string::size_type limit, std::string& binary, armor_info& info)
+{
+    std::string::size_type pos = armor_next_line(text, begin, limit);
+
+    // Armor headers ("Key: Value") end with the first blank line
+    while (pos < limit) {
+        std::string::size_type line_start = pos;
+        std::string::size_type eol = armor_next_line(text, pos, limit);
+        std::string line = text.substr(pos, eol - pos);
+        while (line.length() && (line[line.length() - 1] == '\n'
+            || line[line.length() - 1] == '\r' || line[line.length() - 1] == ' '))
+            line.erase(line.length() - 1);
+        pos = eol;
+        if (!line.length())
+            break;
+        std::string::size_type sep = line.find(": ");
+        if (sep == std::string::npos) {
+            // Not a header; some producers omit the blank line
+            pos = line_start;
+            break;
+        }
+        info.headers[line.substr(0, sep)] = line.substr(sep + 2);
+    }
+
+    // The body ends with the optional "=XXXX" checksum line or the END line
+    std::string::size_type body_end = pos;
+    std::string::size_type crc_line = std::string::npos;
+    while (body_end < limit) {
+        if (text[body_end] == '=') {
+            crc_line = body_end;
+            break;
+        }
+        if (text[body_end] == '-')
+            break;
+        body_end = armor_next_line(text, body_end, limit);
+    }
+
+    if (!armor_b64_decode(text.data() + pos, body_end - pos, binary))
+        return false;
+
+    info.has_crc = false;
+    info.crc_valid = false;
+    if (crc_line != std::string::npos) {
+        std::string crc_bin;
+        std::string::size_type eol = armor_next_line(text, crc_line, limit);
+        if (armor_b64_decode(text.data() + crc_line + 1, eol - crc_line - 1, crc_bin)
+            && crc_bin.length() == 3) {
+            unsigned long crc = ((unsigned long) (unsigned char) crc_bin[0] << 16)
+                | ((unsigned long) (unsigned char) crc_bin[1] << 8)
+                | (unsigned long) (unsigned char) crc_bin[2];
+            info.has_crc = true;
+            info.crc_valid = (crc == armor_crc24(binary));
+        }
+    }
+
+    return true;
+}
+
+/* Formats 8 bytes of a packet as a key id the way gpgme reports them */
+static std::string armor_keyid(const std::string& data, std::string::size_type off)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    std::string keyid;
+    for (int i = 0; i < 8; i++) {
+        unsigned char c = data[off + i];
+        keyid += hex[c >> 4];
+        keyid += hex[c & 0x0F];
+    }
+    return keyid;
+}
+
+/* Returns the issuer key id of a signature packet body, or "" */
+static std::string armor_sig_issuer(const std::string& body)
+{
+    if (body.length() < 1)
+        return "";
+
+    if (body[0] == 3 || body[0] == 2) {
+        // v3: version, hashed length (5), type, time, key id
+        if (body.length() >= 15)
+            return armor_keyid(body, 7);
+        return "";
+    }
+
+    if (body[0] != 4 || body.length() < 6)
+        return "";
+
+    // v4: version, type, pk algo, hash algo, then the hashed and unhashed
+    //  subpacket areas, either of which may hold the issuer (type 16)
+    std::string::size_type pos = 4;
+    for (int area = 0; area < 2; area++) {
+        if (pos + 2 > body.length())
+            return "";
+        std::string::size_type area_len = ((unsigned char) body[pos] << 8)
+            | (unsigned char) body[pos + 1];
+        pos += 2;
+        std::string::size_type area_end = pos + area_len;
+        if (area_end > body.length())
+            return "";
+        while (pos < area_end) {
+            unsigned char c = body[pos++];
+            std::string::size_type sp_len;
+            if (c < 192) {
+                sp_len = c;
+            } else if (c < 255) {
+                if (pos >= area_end)
+                    return "";
+                sp_len = ((c - 192) << 8) + (unsigned char) body[pos++] + 192;
+            } else {
+                if (pos + 4 > area_end)
+                    return "";
+                sp_len = ((std::string::size_type) (unsigned char) body[pos] << 24)
+                    | ((unsigned char) body[pos + 1] << 16)
+                    | ((unsigned char) body[pos + 2] << 8)
+                    | (unsigned char) body[pos + 3];
+                pos += 4;
+            }
+            if (!sp_len || pos + sp_len > area_end)
+                return "";
+            if ((body[pos] & 0x7F) == 16 && sp_len == 9)
+                return armor_keyid(body, pos + 1);
+            pos += sp_len;
+        }
+    }
+
+    return "";
+}
+
+/* Walks the top level packets of the binary data, recording the packet
+    tags and the key ids found in the session key and signature packets.
+    Walking stops at the first packet which cannot be inspected without
+    decryption or decompression. */
+static void armor_parse_packets(const std::string& data, armor_info& info)
+{
+    std::string::size_type pos = 0;
+
+    while (pos < data.length()) {
+        unsigned char ctb = data[pos++];
+        int tag;
+        std::string::size_type len = 0;
+        bool partial = false;
+
+        if (!(ctb & 0x80))
+            return;
+
+        if (ctb & 0x40) {
+            // new format packet header
+            tag = ctb & 0x3F;
+            if (pos >= data.length())
+                return;
+            unsigned char c = data[pos++];
+            if (c < 192) {
+                len = c;
+            } else if (c < 224) {
+                if (pos >= data.length())
+                    return;
+                len = ((c - 192) << 8) + (unsigned char) data[pos++] + 192;
+            } else if (c == 255) {
+                if (pos + 4 > data.length())
+                    return;
+                len = ((std::string::size_type) (unsigned char) data[pos] << 24)
+                    | ((unsigned char) data[pos + 1] << 16)
+                    | ((unsigned char) data[pos + 2] << 8)
+                    | (unsigned char) data[pos + 3];
+                pos += 4;
+            } else {
+                partial = true;
+            }
+        } else {
+            // old format packet header
+            tag = (ctb >> 2) & 0x0F;
+            int len_type = ctb & 0x03;
+            if (len_type == 3) {
+                partial = true;
+            } else {
+                int nbytes = 1 << len_type;
+                if (pos + nbytes > data.length())
+                    return;
+                for (int i = 0; i < nbytes; i++)
+                    len = (len << 8) | (unsigned char) data[pos++];
+            }
+        }
+
+        info.packet_tags.push_back(tag);
+
+        // Packets with an indeterminate or partial length are the bulk
+        //  data packets; nothing beyond them can be seen from here
+        if (partial)
+            return;
+        if (pos + len > data.length())
+            len = data.length() - pos;
+
+        std::string body = data.substr(pos, len);
+        switch (tag) {
+            case 1:
+                // Public-Key Encrypted Session Key
+                if (body.length() >= 9 && body[0] == 3)
+                    info.recipients.push_back(armor_keyid(body, 1));
+                break;
+
+            case 2: {
+                // Signature
+                std::string issuer = armor_sig_issuer(body);
+                if (issuer.length() && std::find(info.signers.begin(),
+                    info.signers.end(), issuer) == info.signers.end())
+                    info.signers.push_back(issuer);
+                break;
+            }
+
+            case 3:
+                // Symmetric-Key Encrypted Session Key
+                info.symmetric = true;
+                break;
+
+            case 4:
+                // One-Pass Signature
+                if (body.length() >= 13 && body[0] == 3
+                    && std::find(info.signers.begin(), info.signers.end(),
+                    armor_keyid(body, 4)) == info.signers.end())
+                    info.signers.push_back(armor_keyid(body, 4));
+                break;
+
+            case 8:
+            case 9:
+            case 18:
+                // Compressed, or encrypted data
+                return;
+
+            default:
+                break;
+        }
+
+        pos += len;
+    }
+}
+
+/* Classifies the armored block located at block within text */
+static armor_info armor_classify(const std::string& text, const armor_block& block)
+{
+    armor_info info;
+    std::string binary;
+
+    info.label = block.label;
+    info.message_type = "unknown";
+    info.clearsigned = false;
+    info.symmetric = false;
+    info.has_crc = false;
+    info.crc_valid = false;
+
+    std::string::size_type section = block.begin;
+
+    if (block.label == "SIGNED MESSAGE") {
+        // The hash header belongs to the cleartext part; the packets are
+        //  in the trailing signature section
+        std::string::size_type eol = armor_next_line(text, block.begin, block.end);
+        std::string::size_type hdr_end = text.find("\n\n", eol);
+        std::string::size_type hdr_end_cr = text.find("\n\r\n", eol);
+        if (hdr_end_cr < hdr_end)
+            hdr_end = hdr_end_cr;
+        if (hdr_end != std::string::npos && hdr_end < block.end) {
+            std::string hdr = text.substr(eol, hdr_end - eol);
+            std::string::size_type h = hdr.find("Hash: ");
+            if (h != std::string::npos) {
+                std::string::size_type h_end = hdr.find_first_of("\r\n", h);
+                info.headers["Hash"] = hdr.substr(h + 6,
+                    h_end == std::string::npos ? std::string::npos : h_end - h - 6);
+            }
+        }
+
+        std::string sig_begin = armor_begin;
+        sig_begin += "SIGNATURE";
+        sig_begin += armor_dashes;
+        section = text.find(sig_begin, block.begin);
+        if (section == std::string::npos || section > block.end)
+            return info;
+        info.clearsigned = true;
+    }
+
+    if (!armor_decode(text, section, block.end, binary, info))
+        return info;
+
+    armor_parse_packets(binary, info);
+
+    if (block.label == "SIGNED MESSAGE") {
+        info.message_type = "signed_message";
+    } else if (block.label == "SIGNATURE") {
+        info.message_type = "detached_signature";
+    } else if (block.label == "PUBLIC KEY BLOCK") {
+        info.message_type = "public_key_block";
+    } else if (block.label == "PRIVATE KEY BLOCK" || block.label == "SECRET KEY BLOCK") {
+        info.message_type = "private_key_block";
+    } else if (block.label == "MESSAGE" && info.packet_tags.size()) {
+        switch (info.packet_tags[0]) {
+            case 1:
+            case 3:
+            case 9:
+            case 18:
+                info.message_type = "encrypted_message";
+                break;
+
+            case 2:
+            case 4:
+                info.message_type = "signed_message";
+                break;
+
+            case 8:
+                info.message_type = "compressed_message";
+                break;
+
+            case 11:
+                info.message_type = "literal_message";
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return info;
+}
+
+/* Returns true if the packet tag starts an encrypted message; a session key
+    (PKESK, SKESK) or the encrypted data itself (SED, SEIPD, AEAD) */
+static bool armor_encrypted_tag(int tag)
+{
+    return tag == 1 || tag == 3 || tag == 9 || tag == 18 || tag == 20;
+}
+
+/* Returns true if data holds an encrypted message, either as an armored
+    block anywhere in the text or as binary packets. A verify operation
+    must not be given such data; gpg would decrypt it and ask the agent
+    for the secret key. */
+static bool armor_is_encrypted(const std::string& data)
+{
+    armor_block block;
+    std::string::size_type pos = 0;
+    bool armored = false;
+
+    while (armor_find_block(data, pos, block)) {
+        armored = true;
+        if (block.label == "MESSAGE") {
+            armor_info info = armor_classify(data, block);
+            if (info.packet_tags.size() && armor_encrypted_tag(info.packet_tags[0]))
+                return true;
+        }
+        pos = block.end;
+    }
+
+    if (armored)
+        return false;
+
+    armor_info info;
+    info.symmetric = false;
+    armor_parse_packets(data, info);
+    return info.packet_tags.size() && armor_encrypted_tag(info.packet_tags[0]);
+}
+
+#endif // H_gpgAuthPluginARMOR
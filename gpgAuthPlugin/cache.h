@@ -0,0 +1,331 @@
+/**********************************************************\
+Original Author: Kyle L. Huff (kylehuff)
+
+Created:    Jan 14, 2011
+License:    GNU General Public License, version 2
+            http://www.gnu.org/licenses/gpl-2.0.html
+
+Copyright 2011 Kyle L. Huff, CURETHEITCH development team
+\**********************************************************/
+
+/*
+ * Helpers for caching the results of gpg operations inside of the plugin.
+ *
+ * Results are keyed by the SHA-256 of the data they were computed from and
+ *  tagged with a stamp of the keyring and trustdb files; an entry is only
+ *  returned while the stamp it was stored with still matches, so that any
+ *  change to the keys or to the trust assignments invalidates it.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <stdio.h>
+#include <string>
+#include <list>
+#include <map>
+#include <boost/thread/mutex.hpp>
+
+#ifndef H_gpgAuthPluginCACHE
+#define H_gpgAuthPluginCACHE
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const unsigned int sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// The running state of a SHA-256 computation
+struct sha256_ctx {
+    unsigned int h[8];
+    unsigned char block[64];
+    unsigned int block_len;
+    unsigned long long total_len;
+};
+
+inline void sha256_transform(sha256_ctx& ctx, const unsigned char *p)
+{
+    unsigned int w[64];
+    unsigned int a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = ((unsigned int) p[i * 4] << 24) | ((unsigned int) p[i * 4 + 1] << 16)
+            | ((unsigned int) p[i * 4 + 2] << 8) | (unsigned int) p[i * 4 + 3];
+    for (i = 16; i < 64; i++)
+        w[i] = (SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10))
+            + w[i - 7]
+            + (SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3))
+            + w[i - 16];
+
+    a = ctx.h[0]; b = ctx.h[1]; c = ctx.h[2]; d = ctx.h[3];
+    e = ctx.h[4]; f = ctx.h[5]; g = ctx.h[6]; h = ctx.h[7];
+
+    for (i = 0; i < 64; i++) {
+        t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25))
+            + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22))
+            + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    ctx.h[0] += a; ctx.h[1] += b; ctx.h[2] += c; ctx.h[3] += d;
+    ctx.h[4] += e; ctx.h[5] += f; ctx.h[6] += g; ctx.h[7] += h;
+}
+
+inline void sha256_init(sha256_ctx& ctx)
+{
+    ctx.h[0] = 0x6a09e667; ctx.h[1] = 0xbb67ae85;
+    ctx.h[2] = 0x3c6ef372; ctx.h[3] = 0xa54ff53a;
+    ctx.h[4] = 0x510e527f; ctx.h[5] = 0x9b05688c;
+    ctx.h[6] = 0x1f83d9ab; ctx.h[7] = 0x5be0cd19;
+    ctx.block_len = 0;
+    ctx.total_len = 0;
+}
+
+inline void sha256_update(sha256_ctx& ctx, const char *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) data;
+
+    ctx.total_len += len;
+    while (len > 0) {
+        if (ctx.block_len == 0 && len >= 64) {
+            sha256_transform(ctx, p);
+            p += 64;
+            len -= 64;
+            continue;
+        }
+        ctx.block[ctx.block_len++] = *p++;
+        len--;
+        if (ctx.block_len == 64) {
+            sha256_transform(ctx, ctx.block);
+            ctx.block_len = 0;
+        }
+    }
+}
+
+// Finishes the computation and returns the digest as a lower-case hex string
+inline std::string sha256_final(sha256_ctx& ctx)
+{
+    unsigned long long bits = ctx.total_len * 8;
+    unsigned char pad = 0x80;
+    unsigned char len_be[8];
+    char hex[65];
+    int i;
+
+    sha256_update(ctx, (const char *) &pad, 1);
+    pad = 0;
+    while (ctx.block_len != 56)
+        sha256_update(ctx, (const char *) &pad, 1);
+    for (i = 0; i < 8; i++)
+        len_be[i] = (unsigned char) (bits >> (56 - i * 8));
+    sha256_update(ctx, (const char *) len_be, 8);
+
+    for (i = 0; i < 8; i++)
+        sprintf(hex + i * 8, "%08x", ctx.h[i]);
+
+    return std::string(hex, 64);
+}
+
+inline std::string sha256_hex(const std::string& data)
+{
+    sha256_ctx ctx;
+
+    sha256_init(ctx);
+    sha256_update(ctx, data.data(), data.length());
+
+    return sha256_final(ctx);
+}
+
+// Counts the changes the plugin itself made to the keyrings or the trustdb
+inline unsigned long keyring_generation(bool increment=false)
+{
+    static boost::mutex mutex;
+    static unsigned long generation = 0;
+    boost::mutex::scoped_lock lock(mutex);
+
+    if (increment)
+        generation++;
+    return generation;
+}
+
+// Called after every operation of the plugin that may modify the keyrings
+//  or the trustdb, so that a change within the resolution of the file
+//  times still changes the keyring stamp
+inline void keyring_changed()
+{
+    keyring_generation(true);
+}
+
+// Returns a string that changes whenever the public or secret keyring or the
+//  trustdb found in homedir are modified, replaced or removed
+inline std::string keyring_stamp(const std::string& homedir)
+{
+    static const char *files[] = { "pubring.gpg", "pubring.kbx", "trustdb.gpg",
+        "secring.gpg", "private-keys-v1.d" };
+    std::string stamp;
+    struct stat st;
+    char buf[96];
+    size_t i;
+
+    sprintf(buf, "%lu;", keyring_generation());
+    stamp += buf;
+
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+#ifdef HAVE_W32_SYSTEM
+        std::string path = homedir + "\\" + files[i];
+#else
+        std::string path = homedir + "/" + files[i];
+#endif
+        if (stat(path.c_str(), &st) != 0) {
+            sprintf(buf, "-;");
+        } else {
+            // Include the sub-second part of the mtime where the platform
+            //  provides it; an in-place trustdb update keeps the size
+#if defined(__APPLE__)
+            long nsec = (long) st.st_mtimespec.tv_nsec;
+#elif defined(HAVE_W32_SYSTEM) || defined(_WIN32)
+            long nsec = 0;
+#else
+            long nsec = (long) st.st_mtim.tv_nsec;
+#endif
+            sprintf(buf, "%ld.%09ld.%ld;", (long) st.st_mtime, nsec,
+                (long) st.st_size);
+        }
+        stamp += buf;
+    }
+
+    return stamp;
+}
+
+// Overwrites the contents of a string before it is released
+inline void scrub_string(std::string& s)
+{
+    if (s.length()) {
+        volatile char *p = &s[0];
+        for (size_t i = 0; i < s.length(); i++)
+            p[i] = 0;
+    }
+    s.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class  lru_cache
+///
+/// @brief  A size bounded least-recently-used map of results. Each entry
+///         carries the keyring stamp it was computed under and an optional
+///         expiration time; a lookup with a different stamp or after the
+///         expiration drops the entry and reports a miss. If a scrub method
+///         is given, it is called on every value before it leaves the cache.
+////////////////////////////////////////////////////////////////////////////////
+template <typename V>
+class lru_cache
+{
+public:
+    lru_cache(size_t capacity, void (*scrub)(V& value)=NULL)
+        : m_capacity(capacity), m_scrub(scrub) {}
+    ~lru_cache() { clear(); }
+
+    bool get(const std::string& key, const std::string& stamp, V& value)
+    {
+        typename index_map::iterator it = m_index.find(key);
+        if (it == m_index.end())
+            return false;
+
+        if (it->second->stamp != stamp
+            || (it->second->expires && it->second->expires <= time(NULL))) {
+            erase(it);
+            return false;
+        }
+
+        // Move the entry to the front of the list
+        m_items.splice(m_items.begin(), m_items, it->second);
+        value = it->second->value;
+        return true;
+    }
+
+    void put(const std::string& key, const std::string& stamp,
+        time_t expires, const V& value)
+    {
+        if (m_capacity == 0)
+            return;
+
+        typename index_map::iterator it = m_index.find(key);
+        if (it != m_index.end())
+            erase(it);
+
+        entry item;
+        item.key = key;
+        item.stamp = stamp;
+        item.expires = expires;
+        item.value = value;
+        m_items.push_front(item);
+        m_index[key] = m_items.begin();
+        if (m_scrub)
+            m_scrub(item.value);
+
+        trim();
+    }
+
+    void set_capacity(size_t capacity)
+    {
+        m_capacity = capacity;
+        trim();
+    }
+
+    size_t capacity() const { return m_capacity; }
+    size_t size() const { return m_index.size(); }
+
+    void clear()
+    {
+        if (m_scrub) {
+            for (typename entry_list::iterator it = m_items.begin();
+                it != m_items.end(); ++it)
+                m_scrub(it->value);
+        }
+        m_items.clear();
+        m_index.clear();
+    }
+
+private:
+    struct entry {
+        std::string key;
+        std::string stamp;
+        time_t expires;
+        V value;
+    };
+    typedef std::list<entry> entry_list;
+    typedef std::map<std::string, typename entry_list::iterator> index_map;
+
+    void erase(typename index_map::iterator it)
+    {
+        if (m_scrub)
+            m_scrub(it->second->value);
+        m_items.erase(it->second);
+        m_index.erase(it);
+    }
+
+    void trim()
+    {
+        while (m_index.size() > m_capacity)
+            erase(m_index.find(m_items.back().key));
+    }
+
+    size_t m_capacity;
+    void (*m_scrub)(V& value);
+    entry_list m_items;
+    index_map m_index;
+};
+
+#endif // H_gpgAuthPluginCACHE
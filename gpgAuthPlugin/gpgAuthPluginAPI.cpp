@@ -14,8 +14,22 @@ Copyright 2011 Kyle L. Huff, CURETHEITCH development team
 #include "DOM/Window.h"
 #include "global/config.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_W32_SYSTEM
+#include <io.h>
+#else
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#endif
+
 #include "gpgAuthPluginAPI.h"
 #include "keyedit.h"
+#include "armor.h"
 
 /*
  * Define non-member methods/inlines
@@ -25,6 +39,10 @@ Copyright 2011 Kyle L. Huff, CURETHEITCH development team
 #define __func__ __FUNCTION__
 #endif
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 FB::VariantMap get_error_map(const std::string& method,
                         gpgme_error_t gpg_error_code,
                         const std::string& error_string,
@@ -43,6 +61,99 @@ FB::VariantMap get_error_map(const std::string& method,
     return error_map_obj;
 }
 
+/* Returns true if the member name of the optional options object is set
+    and evaluates to true */
+bool option_enabled(const boost::optional<FB::VariantMap>& options,
+                        const std::string& name)
+{
+    if (!options)
+        return false;
+
+    FB::VariantMap::const_iterator it = options->find(name);
+    if (it == options->end() || it->second.empty())
+        return false;
+
+    return it->second.convert_cast<bool>();
+}
+
+/* Returns the error map for a UID signature that failed with err; gpg
+    reports some refusals with the status code instead of an error */
+FB::VariantMap sign_uid_error_map(const std::string& method,
+                        gpgme_error_t err, int line)
+{
+    if (err == GPGME_STATUS_ALREADY_SIGNED)
+        return get_error_map(method, err, "The selected UID has already been signed with this key.", line, __FILE__);
+    if (err == GPGME_STATUS_KEYEXPIRED || err == GPGME_STATUS_SIGEXPIRED)
+        return get_error_map(method, err, "This key is expired; You cannot sign using an expired key.", line, __FILE__);
+    return get_error_map(method, gpgme_err_code (err), gpgme_strerror (err), line, __FILE__);
+}
+
+/* Quotes s as a single argument for the command interpreter */
+std::string shell_quote(const std::string& s)
+{
+#ifdef HAVE_W32_SYSTEM
+    return "\"" + s + "\"";
+#else
+    std::string quoted = "'";
+    for (size_t i = 0; i < s.length(); i++) {
+        if (s[i] == '\'')
+            quoted += "'\\''";
+        else
+            quoted += s[i];
+    }
+    return quoted + "'";
+#endif
+}
+
+/* Returns true if the paths a and b name the same file; when both exist
+    the device and inode are compared so links and other spellings of the
+    path are caught as well */
+bool same_file(const std::string& a, const std::string& b)
+{
+    struct stat a_stat, b_stat;
+
+    if (a == b)
+        return true;
+#ifdef HAVE_W32_SYSTEM
+    if (_stricmp(a.c_str(), b.c_str()) == 0)
+        return true;
+#else
+    if (stat(a.c_str(), &a_stat) == 0 && stat(b.c_str(), &b_stat) == 0)
+        return a_stat.st_dev == b_stat.st_dev
+            && a_stat.st_ino == b_stat.st_ino;
+#endif
+    return false;
+}
+
+/* Creates and opens a new file next to path for writing; the name of the
+    file is stored in tmp_path. Returns the descriptor or -1 with errno set */
+int open_temp_beside(const std::string& path, std::string& tmp_path)
+{
+    static int counter = 0;
+    int fd = -1;
+
+    for (int tries = 0; fd < 0 && tries < 100; tries++) {
+        tmp_path = path + "." + i_to_str((int) time(NULL)) + "-"
+            + i_to_str(counter++) + ".tmp";
+        fd = open(tmp_path.c_str(),
+            O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0600);
+        if (fd < 0 && errno != EEXIST)
+            break;
+    }
+    return fd;
+}
+
+/* Moves the file at from over the file at to */
+int replace_file(const std::string& from, const std::string& to)
+{
+#ifdef HAVE_W32_SYSTEM
+    return MoveFileExA(from.c_str(), to.c_str(),
+        MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+    return rename(from.c_str(), to.c_str());
+#endif
+}
+
 /* An inline method to convert a null char */
 inline
 static const char *
@@ -51,6 +162,200 @@ static const char *
       return s? s :"[none]";
     }
 
+/* Converts the result of armor_classify() into a javascript object */
+FB::VariantMap get_armor_info_map(const armor_info& info,
+                        const armor_block& block)
+{
+    FB::VariantMap armor_map;
+    FB::VariantMap recipients_map;
+    FB::VariantMap signers_map;
+    FB::VariantMap headers_map;
+    size_t i;
+
+    armor_map["message_type"] = info.message_type;
+    armor_map["armor_label"] = info.label;
+    armor_map["begin"] = (long) block.begin;
+    armor_map["end"] = (long) block.end;
+    armor_map["clearsigned"] = info.clearsigned;
+    armor_map["symmetric"] = info.symmetric;
+    armor_map["has_crc"] = info.has_crc;
+    armor_map["crc_valid"] = info.crc_valid;
+
+    for (i = 0; i < info.recipients.size(); i++)
+        recipients_map[i_to_str(i)] = info.recipients[i];
+    armor_map["recipients"] = recipients_map;
+
+    for (i = 0; i < info.signers.size(); i++)
+        signers_map[i_to_str(i)] = info.signers[i];
+    armor_map["signers"] = signers_map;
+
+    for (std::map<std::string, std::string>::const_iterator it =
+        info.headers.begin(); it != info.headers.end(); ++it)
+        headers_map[it->first] = it->second;
+    armor_map["headers"] = headers_map;
+
+    return armor_map;
+}
+
+/* Converts the signatures of a verify result into a javascript object */
+FB::VariantMap get_signatures_map(gpgme_verify_result_t verify_result)
+{
+    FB::VariantMap signatures;
+    gpgme_signature_t sig;
+    int nsigs;
+
+    if (!verify_result)
+        return signatures;
+
+    for (nsigs=0, sig=verify_result->signatures; sig; sig = sig->next, nsigs++) {
+        FB::VariantMap signature;
+        signature["fingerprint"] = nonnull (sig->fpr);
+        signature["timestamp"] = sig->timestamp;
+        signature["expiration"] = sig->exp_timestamp;
+        signature["validity"] = sig->validity == GPGME_VALIDITY_UNKNOWN? "unknown":
+                sig->validity == GPGME_VALIDITY_UNDEFINED? "undefined":
+                sig->validity == GPGME_VALIDITY_NEVER? "never":
+                sig->validity == GPGME_VALIDITY_MARGINAL? "marginal":
+                sig->validity == GPGME_VALIDITY_FULL? "full":
+                sig->validity == GPGME_VALIDITY_ULTIMATE? "ultimate": "[?]";
+        signature["status"] = gpg_err_code (sig->status) == GPG_ERR_NO_ERROR? "GOOD":
+                gpg_err_code (sig->status) == GPG_ERR_BAD_SIGNATURE? "BAD_SIG":
+                gpg_err_code (sig->status) == GPG_ERR_NO_PUBKEY? "NO_PUBKEY":
+                gpg_err_code (sig->status) == GPG_ERR_NO_DATA? "NO_SIGNATURE":
+                gpg_err_code (sig->status) == GPG_ERR_SIG_EXPIRED? "GOOD_EXPSIG":
+                gpg_err_code (sig->status) == GPG_ERR_KEY_EXPIRED? "GOOD_EXPKEY": "INVALID";
+        signatures[i_to_str(nsigs)] = signature;
+    }
+
+    return signatures;
+}
+
+/* Serializes the process wide setup done when a gpgme context is created */
+static boost::mutex gpgme_setup_mutex;
+
+/* Returns the number of worker threads a batch operation may run gpgme in,
+    given the requested number; without the thread safe build of gpgme the
+    workers have to run one at a time */
+int gpgme_max_workers(long requested)
+{
+#if defined(HAVE_GPGME_PTHREAD) || defined(HAVE_W32_SYSTEM)
+    if (requested > 8)
+        return 8;
+    return (requested < 1) ? 1 : (int) requested;
+#else
+    return 1;
+#endif
+}
+
+/* A gpgme data write callback that hashes and discards everything written */
+ssize_t hash_sink_write(void *handle, const void *buffer, size_t size)
+{
+    sha256_update(*(sha256_ctx *) handle, (const char *) buffer, size);
+    return size;
+}
+
+/* A gpgme data write callback that discards everything written */
+ssize_t discard_sink_write(void *handle, const void *buffer, size_t size)
+{
+    return size;
+}
+
+// The state of a bounded output sink; see bounded_sink_write()
+struct boundedSink {
+    std::string data;
+    std::string::size_type max_bytes;
+    bool truncated;
+};
+
+/* A gpgme data write callback that keeps the first max_bytes written and
+    then fails the write, which makes gpgme abort the operation */
+ssize_t bounded_sink_write(void *handle, const void *buffer, size_t size)
+{
+    boundedSink* sink = (boundedSink *) handle;
+    std::string::size_type room = sink->max_bytes - sink->data.length();
+
+    if (size > room) {
+        sink->data.append((const char *) buffer, room);
+        sink->truncated = true;
+        errno = EPIPE;
+        return -1;
+    }
+
+    sink->data.append((const char *) buffer, size);
+    return size;
+}
+
+/* Drops an incomplete UTF-8 sequence from the end of text */
+void trim_partial_utf8(std::string& text)
+{
+    std::string::size_type len = text.length();
+    std::string::size_type i = len;
+    int needed;
+
+    // Find the lead byte of the last sequence
+    while (i > 0 && len - i < 4 && (text[i - 1] & 0xC0) == 0x80)
+        i--;
+    if (i == 0)
+        return;
+
+    unsigned char lead = text[i - 1];
+    needed = (lead & 0xE0) == 0xC0 ? 2 : (lead & 0xF0) == 0xE0 ? 3 :
+        (lead & 0xF8) == 0xF0 ? 4 : 1;
+    if (len - (i - 1) < (std::string::size_type) needed)
+        text.erase(i - 1);
+}
+
+/* Returns the member name of map converted to a long, or default_value if
+    it is missing or empty */
+long map_long(const FB::VariantMap& map, const std::string& name, long default_value)
+{
+    FB::VariantMap::const_iterator it = map.find(name);
+    if (it == map.end() || it->second.empty())
+        return default_value;
+
+    return it->second.convert_cast<long>();
+}
+
+/* Returns the member name of map as a string, or an empty string if it is
+    missing or empty */
+std::string map_string(const FB::VariantMap& map, const std::string& name)
+{
+    FB::VariantMap::const_iterator it = map.find(name);
+    if (it == map.end() || it->second.empty())
+        return "";
+
+    return it->second.convert_cast<std::string>();
+}
+
+/* The prefix of the handles given out by the handle table */
+static const char handle_prefix[] = "webpg-handle:";
+
+/* The number of cancelled gpgReencryptBatch jobs kept for resuming */
+static const size_t reencrypt_max_resumable = 8;
+
+/* Returns the handle named by the member name of options, or an empty
+    string if it is not set; rest receives options without that member, so
+    that the remaining options can be passed on */
+std::string handle_option(const boost::optional<FB::VariantMap>& options,
+                        const std::string& name,
+                        boost::optional<FB::VariantMap>& rest)
+{
+    rest = options;
+    if (!options)
+        return "";
+
+    std::string handle = map_string(*options, name);
+    rest->erase(name);
+    return handle;
+}
+
+/* A shared_ptr deleter that wipes the buffer of a handle */
+void delete_handle_data(std::string* data)
+{
+    scrub_string(*data);
+    delete data;
+}
+
 std::string LoadFileAsString(const std::string& filename)
 {
     std::ifstream fin(filename.c_str());
@@ -85,7 +390,11 @@ static bool gpgme_invalid = false;
 ///         public web page. This flag is set at compile time, and cannot be
 ///         modified during operation.
 ///////////////////////////////////////////////////////////////////////////////
-gpgAuthPluginAPI::gpgAuthPluginAPI(const gpgAuthPluginPtr& plugin, const FB::BrowserHostPtr& host) : m_plugin(plugin), m_host(host)
+gpgAuthPluginAPI::gpgAuthPluginAPI(const gpgAuthPluginPtr& plugin, const FB::BrowserHostPtr& host) : verify_cache(128),
+    decrypt_cache(64, scrub_decrypt_entry), decrypt_cache_timeout(0),
+    handle_counter(0), reencrypt_job_counter(0), running_workers(0),
+    shutting_down(false), sign_uid_job_counter(0), trust_graph_generation(0),
+    domain_key_memo(256), m_plugin(plugin), m_host(host)
 {
     static bool allow_op = true;
 #ifdef _EXTENSIONIZE
@@ -105,16 +414,33 @@ gpgAuthPluginAPI::gpgAuthPluginAPI(const gpgAuthPluginPtr& plugin, const FB::Bro
         registerMethod("getNamedKey", make_method(this, &gpgAuthPluginAPI::getNamedKey));
         registerMethod("getDomainKey", make_method(this, &gpgAuthPluginAPI::getNamedKey));
         registerMethod("verifyDomainKey", make_method(this, &gpgAuthPluginAPI::verifyDomainKey));
+        registerMethod("verifyDomainKeyBatch", make_method(this, &gpgAuthPluginAPI::verifyDomainKeyBatch));
+        registerMethod("findTrustPath", make_method(this, &gpgAuthPluginAPI::findTrustPath));
         registerMethod("gpgSetPreference", make_method(this, &gpgAuthPluginAPI::gpgSetPreference));
         registerMethod("gpgGetPreference", make_method(this, &gpgAuthPluginAPI::gpgGetPreference));
         registerMethod("gpgSetHomeDir", make_method(this, &gpgAuthPluginAPI::gpgSetHomeDir));
         registerMethod("gpgGetHomeDir", make_method(this, &gpgAuthPluginAPI::gpgGetHomeDir));
         registerMethod("gpgEncrypt", make_method(this, &gpgAuthPluginAPI::gpgEncrypt));
         registerMethod("gpgSymmetricEncrypt", make_method(this, &gpgAuthPluginAPI::gpgSymmetricEncrypt));
+        registerMethod("gpgAddRecipients", make_method(this, &gpgAuthPluginAPI::gpgAddRecipients));
+        registerMethod("gpgReencryptBatch", make_method(this, &gpgAuthPluginAPI::gpgReencryptBatch));
+        registerMethod("gpgCancelReencrypt", make_method(this, &gpgAuthPluginAPI::gpgCancelReencrypt));
+        registerMethod("gpgResumeReencrypt", make_method(this, &gpgAuthPluginAPI::gpgResumeReencrypt));
+        registerMethod("gpgDiscardReencrypt", make_method(this, &gpgAuthPluginAPI::gpgDiscardReencrypt));
+        registerMethod("getReencryptStatus", make_method(this, &gpgAuthPluginAPI::getReencryptStatus));
         registerMethod("gpgDecrypt", make_method(this, &gpgAuthPluginAPI::gpgDecrypt));
+        registerMethod("gpgDecryptPreview", make_method(this, &gpgAuthPluginAPI::gpgDecryptPreview));
         registerMethod("gpgVerify", make_method(this, &gpgAuthPluginAPI::gpgVerify));
+        registerMethod("gpgVerifyDetached", make_method(this, &gpgAuthPluginAPI::gpgVerifyDetached));
+        registerMethod("classifyPGPData", make_method(this, &gpgAuthPluginAPI::classifyPGPData));
+        registerMethod("processPGPBlocks", make_method(this, &gpgAuthPluginAPI::processPGPBlocks));
         registerMethod("gpgSignText", make_method(this, &gpgAuthPluginAPI::gpgSignText));
+        registerMethod("gpgSignMulti", make_method(this, &gpgAuthPluginAPI::gpgSignMulti));
+        registerMethod("gpgEncryptFile", make_method(this, &gpgAuthPluginAPI::gpgEncryptFile));
+        registerMethod("gpgDecryptFile", make_method(this, &gpgAuthPluginAPI::gpgDecryptFile));
+        registerMethod("gpgSignFile", make_method(this, &gpgAuthPluginAPI::gpgSignFile));
         registerMethod("gpgSignUID", make_method(this, &gpgAuthPluginAPI::gpgSignUID));
+        registerMethod("gpgSignUIDBatch", make_method(this, &gpgAuthPluginAPI::gpgSignUIDBatch));
         registerMethod("gpgEnableKey", make_method(this, &gpgAuthPluginAPI::gpgEnableKey));
         registerMethod("gpgDisableKey", make_method(this, &gpgAuthPluginAPI::gpgDisableKey));
         registerMethod("gpgDeleteUIDSign", make_method(this, &gpgAuthPluginAPI::gpgDeleteUIDSign));
@@ -125,6 +451,8 @@ gpgAuthPluginAPI::gpgAuthPluginAPI(const gpgAuthPluginPtr& plugin, const FB::Bro
         registerMethod("gpgDeletePrivateKey", make_method(this, &gpgAuthPluginAPI::gpgDeletePrivateKey));
         registerMethod("gpgDeletePrivateSubKey", make_method(this, &gpgAuthPluginAPI::gpgDeletePrivateSubKey));
         registerMethod("gpgSetKeyTrust", make_method(this, &gpgAuthPluginAPI::gpgSetKeyTrust));
+        registerMethod("gpgImportOwnerTrust", make_method(this, &gpgAuthPluginAPI::gpgImportOwnerTrust));
+        registerMethod("gpgExportOwnerTrust", make_method(this, &gpgAuthPluginAPI::gpgExportOwnerTrust));
         registerMethod("gpgAddUID", make_method(this, &gpgAuthPluginAPI::gpgAddUID));
         registerMethod("gpgDeleteUID", make_method(this, &gpgAuthPluginAPI::gpgDeleteUID));
         registerMethod("gpgSetPrimaryUID", make_method(this, &gpgAuthPluginAPI::gpgSetPrimaryUID));
@@ -135,13 +463,29 @@ gpgAuthPluginAPI::gpgAuthPluginAPI(const gpgAuthPluginPtr& plugin, const FB::Bro
         registerMethod("gpgRevokeUID", make_method(this, &gpgAuthPluginAPI::gpgRevokeUID));
         registerMethod("gpgRevokeSignature", make_method(this, &gpgAuthPluginAPI::gpgRevokeSignature));
         registerMethod("gpgChangePassphrase", make_method(this, &gpgAuthPluginAPI::gpgChangePassphrase));
+        registerMethod("gpgEditKeyBatch", make_method(this, &gpgAuthPluginAPI::gpgEditKeyBatch));
+        registerMethod("getEditEvents", make_method(this, &gpgAuthPluginAPI::getEditEvents));
 
         registerMethod("setTempGPGOption", make_method(this, &gpgAuthPluginAPI::setTempGPGOption));
         registerMethod("restoreGPGConfig", make_method(this, &gpgAuthPluginAPI::restoreGPGConfig));
         registerMethod("getTemporaryPath", make_method(this, &gpgAuthPluginAPI::getTemporaryPath));
+        registerMethod("createHandle", make_method(this, &gpgAuthPluginAPI::createHandle));
+        registerMethod("readHandle", make_method(this, &gpgAuthPluginAPI::readHandle));
+        registerMethod("retainHandle", make_method(this, &gpgAuthPluginAPI::retainHandle));
+        registerMethod("releaseHandle", make_method(this, &gpgAuthPluginAPI::releaseHandle));
+        registerMethod("setVerifyCacheSize", make_method(this, &gpgAuthPluginAPI::setVerifyCacheSize));
+        registerMethod("clearVerifyCache", make_method(this, &gpgAuthPluginAPI::clearVerifyCache));
+        registerMethod("setDecryptCacheTimeout", make_method(this, &gpgAuthPluginAPI::setDecryptCacheTimeout));
+        registerMethod("flushDecryptCache", make_method(this, &gpgAuthPluginAPI::flushDecryptCache));
 
         registerEvent("onkeygenprogress");
         registerEvent("onkeygencomplete");
+        registerEvent("onfileprogress");
+        registerEvent("onfilecomplete");
+        registerEvent("onreencryptprogress");
+        registerEvent("onreencryptcomplete");
+        registerEvent("onsignuidprogress");
+        registerEvent("onsignuidcomplete");
     }
 
     // Read-only property
@@ -166,9 +510,71 @@ gpgAuthPluginAPI::gpgAuthPluginAPI(const gpgAuthPluginPtr& plugin, const FB::Bro
 /// @brief  Destructor.  Remember that this object will not be released until
 ///         the browser is done with it; this will almost definitely be after
 ///         the plugin is released.
+///
+///         The background workers use this object; running reencrypt jobs
+///         are cancelled and gpgSignUIDBatch workers stop after the key in
+///         progress, and the destructor waits until every worker returned.
 ///////////////////////////////////////////////////////////////////////////////
 gpgAuthPluginAPI::~gpgAuthPluginAPI()
 {
+    {
+        boost::mutex::scoped_lock lock(workers_mutex);
+        shutting_down = true;
+    }
+
+    {
+        boost::mutex::scoped_lock lock(reencrypt_jobs_mutex);
+        std::map<std::string, reencryptJobPtr>::iterator it;
+        for (it = reencrypt_jobs.begin(); it != reencrypt_jobs.end(); it++) {
+            boost::mutex::scoped_lock job_lock(it->second->mutex);
+            it->second->cancelled = true;
+        }
+    }
+
+    {
+        boost::mutex::scoped_lock lock(workers_mutex);
+        while (running_workers > 0)
+            workers_done.wait(lock);
+    }
+
+    flushDecryptCache();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn void gpgAuthPluginAPI::worker_started()
+///
+/// @brief  Counts a background worker thread. It must be called before the
+///         thread is created, and the thread must call worker_finished()
+///         when it no longer uses this object.
+///////////////////////////////////////////////////////////////////////////////
+void gpgAuthPluginAPI::worker_started()
+{
+    boost::mutex::scoped_lock lock(workers_mutex);
+    running_workers++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn void gpgAuthPluginAPI::worker_finished()
+///
+/// @brief  Uncounts a background worker thread and wakes the destructor.
+///////////////////////////////////////////////////////////////////////////////
+void gpgAuthPluginAPI::worker_finished()
+{
+    boost::mutex::scoped_lock lock(workers_mutex);
+    if (--running_workers == 0)
+        workers_done.notify_all();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn bool gpgAuthPluginAPI::is_shutting_down()
+///
+/// @brief  Returns true once the destructor has started; long running
+///         workers check it between items.
+///////////////////////////////////////////////////////////////////////////////
+bool gpgAuthPluginAPI::is_shutting_down()
+{
+    boost::mutex::scoped_lock lock(workers_mutex);
+    return shutting_down;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -289,14 +695,23 @@ void gpgAuthPluginAPI::init()
 ///////////////////////////////////////////////////////////////////////////////
 gpgme_ctx_t gpgAuthPluginAPI::get_gpgme_ctx()
 {
+    static bool locale_set = false;
     gpgme_ctx_t ctx;
     gpgme_error_t err;
 
-    setlocale (LC_ALL, "");
-    gpgme_set_locale (NULL, LC_CTYPE, setlocale (LC_CTYPE, NULL));
+    // The locale is process wide; set it once, as the batch operations
+    //  create their contexts from several threads at the same time
+    {
+        boost::mutex::scoped_lock lock(gpgme_setup_mutex);
+        if (!locale_set) {
+            setlocale (LC_ALL, "");
+            gpgme_set_locale (NULL, LC_CTYPE, setlocale (LC_CTYPE, NULL));
 #ifdef LC_MESSAGES
-    gpgme_set_locale (NULL, LC_MESSAGES, setlocale (LC_MESSAGES, NULL));
+            gpgme_set_locale (NULL, LC_MESSAGES, setlocale (LC_MESSAGES, NULL));
 #endif
+            locale_set = true;
+        }
+    }
 
     // Check the GNUPGHOME variable, if not null, set that
     if (GNUPGHOME.length() > 0) {
@@ -307,8 +722,14 @@ gpgme_ctx_t gpgAuthPluginAPI::get_gpgme_ctx()
                 engine_info->file_name,
                 GNUPGHOME.c_str());
         } else {
-            std::string env = "GNUPGHOME=" + GNUPGHOME;
-            putenv(strdup(env.c_str()));
+            static std::string env_home;
+            boost::mutex::scoped_lock lock(gpgme_setup_mutex);
+            if (env_home != GNUPGHOME) {
+                std::string env = "GNUPGHOME=" + GNUPGHOME;
+                putenv(strdup(env.c_str()));
+                env_home = GNUPGHOME;
+            }
+            gpgme_release (ctx);
             err = gpgme_new (&ctx);
         }
     } else {
@@ -321,6 +742,100 @@ gpgme_ctx_t gpgAuthPluginAPI::get_gpgme_ctx()
     return ctx;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// @fn int gpgAuthPluginAPI::run_gpg(const std::string& args, const std::string& input, std::string& output)
+///
+/// @brief  Runs the gpg binary of the OpenPGP engine in batch mode with the
+///         homedir of the plugin, for operations that gpgme does not provide.
+///         If input is not empty it is written to the standard input of gpg,
+///         otherwise the standard output of gpg is collected in output.
+///
+/// @param  args    The arguments to pass to gpg, already quoted.
+/// @param  input   The data to pass to gpg.
+/// @param  output  Receives the output of gpg.
+///
+/// @returns the exit status of gpg, or -1 if it could not be started or did
+///          not accept all of input.
+///////////////////////////////////////////////////////////////////////////////
+int gpgAuthPluginAPI::run_gpg(const std::string& args, const std::string& input,
+    std::string& output)
+{
+    gpgme_engine_info_t engine_info;
+    std::string cmd;
+    FILE *pipe;
+    char buf[4096];
+    size_t len;
+    bool write_failed = false;
+    int status;
+
+    if (gpgme_get_engine_info (&engine_info) != GPG_ERR_NO_ERROR)
+        return -1;
+    while (engine_info && engine_info->protocol != GPGME_PROTOCOL_OpenPGP)
+        engine_info = engine_info->next;
+    if (!engine_info || !engine_info->file_name)
+        return -1;
+
+    cmd = shell_quote(engine_info->file_name) + " --batch --no-tty";
+    if (GNUPGHOME.length() > 0)
+        cmd += " --homedir " + shell_quote(GNUPGHOME);
+    cmd += " " + args;
+
+#ifdef HAVE_W32_SYSTEM
+    // cmd.exe removes the outer quotes of a command line that starts with one
+    cmd = "\"" + cmd + "\"";
+    pipe = _popen (cmd.c_str(), input.length() ? "wb" : "rb");
+#else
+    pipe = popen (cmd.c_str(), input.length() ? "w" : "r");
+#endif
+    if (!pipe)
+        return -1;
+
+    if (input.length()) {
+#ifdef HAVE_W32_SYSTEM
+        write_failed = fwrite (input.data(), 1, input.length(), pipe) != input.length()
+            || fflush (pipe) != 0;
+#else
+        // A gpg that exits before reading all of input would raise SIGPIPE,
+        //  which terminates the browser; block it for this thread while
+        //  writing and discard it if it was raised
+        sigset_t sigpipe_mask, old_mask, pending;
+        bool was_pending;
+
+        sigemptyset (&sigpipe_mask);
+        sigaddset (&sigpipe_mask, SIGPIPE);
+        pthread_sigmask (SIG_BLOCK, &sigpipe_mask, &old_mask);
+        was_pending = sigpending (&pending) == 0 && sigismember (&pending, SIGPIPE);
+
+        write_failed = fwrite (input.data(), 1, input.length(), pipe) != input.length()
+            || fflush (pipe) != 0;
+
+        if (!was_pending && sigpending (&pending) == 0
+            && sigismember (&pending, SIGPIPE)) {
+            int sig;
+            sigwait (&sigpipe_mask, &sig);
+        }
+        pthread_sigmask (SIG_SETMASK, &old_mask, NULL);
+#endif
+    } else {
+        while ((len = fread (buf, 1, sizeof(buf), pipe)) > 0)
+            output.append(buf, len);
+    }
+
+#ifdef HAVE_W32_SYSTEM
+    status = _pclose (pipe);
+#else
+    status = pclose (pipe);
+    if (status != -1 && WIFEXITED (status))
+        status = WEXITSTATUS (status);
+#endif
+    keyring_changed();
+
+    if (write_failed)
+        return -1;
+
+    return status;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @fn std::string gpgAuthPluginAPI::getGPGConfigFilename()
 ///
@@ -452,6 +967,8 @@ FB::variant gpgAuthPluginAPI::restoreGPGConfig() {
 FB::variant gpgAuthPluginAPI::gpgSetHomeDir(const std::string& gnupg_path)
 {
     GNUPGHOME = gnupg_path;
+    clearVerifyCache();
+    flushDecryptCache();
     return GNUPGHOME;
 }
 
@@ -476,77 +993,482 @@ FB::variant gpgAuthPluginAPI::getTemporaryPath()
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @fn FB::variant gpgAuthPluginAPI::get_webpg_status()
+/// @fn std::string gpgAuthPluginAPI::get_gnupg_homedir()
 ///
-/// @brief  Executes gpgAuthPluginAPI::init() to set the status variables and
-///         populates the "edit_status" property with the contents of the
-///         edit_status constant.
+/// @brief  Determines the directory gpg will use as its homedir; the value of
+///         GNUPGHOME if set, otherwise the GNUPGHOME environment variable or
+///         the platform default.
+///////////////////////////////////////////////////////////////////////////////
+std::string gpgAuthPluginAPI::get_gnupg_homedir()
+{
+    if (GNUPGHOME.length() > 0)
+        return GNUPGHOME;
+
+    char const *env_home = getenv("GNUPGHOME");
+    if (env_home && *env_home)
+        return env_home;
+
+#ifdef HAVE_W32_SYSTEM
+    char const *appdata = getenv("APPDATA");
+    if (appdata)
+        return std::string(appdata) + "\\gnupg";
+#endif
+
+    char const *home = getenv("HOME");
+    if (home || (home = getenv("USERPROFILE")))
+        return std::string(home) + "/.gnupg";
+
+    return "";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn std::string gpgAuthPluginAPI::get_keyring_stamp()
 ///
-/// @returns FB::VariantMap webpg_status_map
+/// @brief  Returns a stamp of the homedir in use and the modification time
+///         and size of its keyrings and trustdb; importing, deleting or
+///         signing keys and changing ownertrust all produce a new stamp.
+///////////////////////////////////////////////////////////////////////////////
+std::string gpgAuthPluginAPI::get_keyring_stamp()
+{
+    std::string homedir = get_gnupg_homedir();
+    return homedir + ":" + keyring_stamp(homedir);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn trustGraphPtr gpgAuthPluginAPI::get_trust_graph()
+///
+/// @brief  Returns the signature graph of the current keyring, building it
+///         from one listing of the public keys (with signatures) and one of
+///         the secret keys when the keyring stamp has changed or a key or
+///         signature in it has expired since it was built. An empty pointer
+///         is returned if the keyring could not be listed.
+///////////////////////////////////////////////////////////////////////////////
+trustGraphPtr gpgAuthPluginAPI::get_trust_graph()
+{
+    std::string stamp = get_keyring_stamp();
+    boost::mutex::scoped_lock lock(trust_graph_mutex);
+
+    if (trust_graph_cache && trust_graph_cache->stamp == stamp
+        && (!trust_graph_cache->expires || time(NULL) < trust_graph_cache->expires))
+        return trust_graph_cache;
+
+    trustGraphPtr graph(new trust_graph());
+    gpgme_ctx_t ctx = get_gpgme_ctx();
+    gpgme_error_t err = trust_graph_build(ctx, *graph);
+    gpgme_release (ctx);
+
+    if (err != GPG_ERR_NO_ERROR) {
+        trust_graph_cache.reset();
+        return trust_graph_cache;
+    }
+
+    graph->stamp = stamp;
+    graph->generation = ++trust_graph_generation;
+    trust_graph_cache = graph;
+
+    return trust_graph_cache;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::createHandle(const std::string& data)
+///
+/// @brief  Stores data in the handle table and returns a handle to it with a
+///         reference count of 1. Methods that accept data read it from the
+///         handle named by their "handle" option instead of the data
+///         argument, and methods that take an options object return a
+///         handle instead of their output when "return_handle" is true, so a
+///         chain of operations only copies the data in and out once. Data is
+///         never taken to be a handle because of what it contains. The
+///         buffer is wiped when the last reference is released.
+///
+/// @param  data    The data to store.
+///
+/// @returns FB::variant response
 /*! @verbatim
-webpg_status_map {
-    "GNUPGHOME":"",
-    "OpenPGP":{
-        "file_name":"/usr/bin/gpg",
-        "req_version":"1.4.0",
-        "version":"1.4.11"
-    },
-    "edit_status":"",
+response {
     "error":false,
-    "gpg_agent_info":"/tmp/keyring-5FZWyz/gpg:0:1",
-    "gpgconf_detected":true,
-    "gpgme_valid":true,
-    "gpgme_version":"1.3.2",
-    "plugin":{
-        "params":{
-            "id":"gpgAuthPlugin",
-            "type":"application/x-webpg"
-        },
-        "path":"plugins/Linux_x86_64-gcc/npgpgAuthPlugin-v0.6.1.so",
-        "source_url":"_generated_background_page.html",
-        "version":"0.6.1"
-    }
+    "handle":"webpg-handle:1"
 }
 @endverbatim
 */
 ///////////////////////////////////////////////////////////////////////////////
-FB::VariantMap gpgAuthPluginAPI::get_webpg_status()
+FB::variant gpgAuthPluginAPI::createHandle(const std::string& data)
 {
-    gpgAuthPluginAPI::init();
-    gpgAuthPluginAPI::webpg_status_map["edit_status"] = edit_status;
-    return gpgAuthPluginAPI::webpg_status_map;
+    FB::VariantMap response;
+    dataHandle entry;
+
+    entry.data = boost::shared_ptr<std::string>(
+        new std::string(data), delete_handle_data);
+    entry.refcount = 1;
+
+    boost::mutex::scoped_lock lock(handles_mutex);
+    std::string handle = handle_prefix + i_to_str(++handle_counter);
+    handles[handle] = entry;
+
+    response["handle"] = handle;
+    response["error"] = false;
+
+    return response;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @fn FB::VariantMap gpgAuthPluginAPI::getKeyList(const std::string& name, int secret_only)
+/// @fn FB::variant gpgAuthPluginAPI::readHandle(const std::string& handle)
 ///
-/// @brief  Retrieves all keys matching name, or if name is not specified,
-///         returns all keys in the keyring. The keyring to use is determined
-///         by the integer value of secret_only.
+/// @brief  Returns the data held by handle in "data".
 ///
-/// @param  name    Name of key to retrieve
-/// @param  secret_only Return only secret keys (private keyring)
-/// @returns FB::VariantMap keylist_map
-/*! @verbatim
-keylist_map {
-    "1E4F6A67ACD1C298":{
-        "can_authenticate":true,
-        "can_certify":true,
-        "can_encrypt":true,
-        "can_sign":true,
-        "disabled":false,
-        "email":"webpg.extension.devel@curetheitch.com",
-        "expired":false,
-        "fingerprint":"68634186B526CC1F959404401E4F6A67ACD1C298",
-        "invalid":false,
-        "is_qualified":false,
-        "name":"WebPG Testing Key",
-        "owner_trust":"marginal",
-        "protocol":"OpenPGP",
-        "revoked":false,
-        "secret":false,
-        "subkeys":{
-            "0":{
+/// @param  handle  The handle to read.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::readHandle(const std::string& handle)
+{
+    FB::VariantMap response;
+    boost::shared_ptr<std::string> ref = get_handle_data(handle);
+
+    if (!ref)
+        return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+
+    response["data"] = *ref;
+    response["error"] = false;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::retainHandle(const std::string& handle)
+///
+/// @brief  Adds a reference to handle; each reference must be released with
+///         gpgAuthPluginAPI::releaseHandle().
+///
+/// @param  handle  The handle to retain.
+///
+/// @returns FB::variant The new reference count, or an error map.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::retainHandle(const std::string& handle)
+{
+    boost::mutex::scoped_lock lock(handles_mutex);
+    std::map<std::string, dataHandle>::iterator it = handles.find(handle);
+
+    if (it == handles.end())
+        return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+
+    return ++it->second.refcount;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::releaseHandle(const std::string& handle)
+///
+/// @brief  Drops a reference to handle; the handle becomes invalid and its
+///         buffer is wiped once the last reference is gone (or, if an
+///         operation is still using it, when that operation finishes).
+///
+/// @param  handle  The handle to release.
+///
+/// @returns FB::variant The remaining reference count, or an error map.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::releaseHandle(const std::string& handle)
+{
+    boost::mutex::scoped_lock lock(handles_mutex);
+    std::map<std::string, dataHandle>::iterator it = handles.find(handle);
+
+    if (it == handles.end())
+        return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+
+    long refcount = --it->second.refcount;
+    if (refcount < 1)
+        handles.erase(it);
+
+    return refcount;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn boost::shared_ptr<std::string> gpgAuthPluginAPI::get_handle_data(const std::string& handle)
+///
+/// @brief  Returns the buffer of handle; an empty pointer is returned if
+///         handle is not a live handle.
+///
+/// @param  handle  The handle named by the caller.
+///////////////////////////////////////////////////////////////////////////////
+boost::shared_ptr<std::string> gpgAuthPluginAPI::get_handle_data(const std::string& handle)
+{
+    boost::mutex::scoped_lock lock(handles_mutex);
+    std::map<std::string, dataHandle>::iterator it = handles.find(handle);
+    if (it == handles.end())
+        return boost::shared_ptr<std::string>();
+
+    return it->second.data;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::handle_response(const FB::variant& response, const boost::optional<FB::VariantMap>& options, const std::string& field)
+///
+/// @brief  If options has "return_handle" set and response is a successful
+///         response map, the member field is moved into a new handle, which
+///         replaces it and is also returned as "handle".
+///
+/// @param  response    The response of the operation.
+/// @param  options The options passed to the operation.
+/// @param  field   The member of response holding the output.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::handle_response(const FB::variant& response,
+    const boost::optional<FB::VariantMap>& options, const std::string& field)
+{
+    if (!option_enabled(options, "return_handle")
+        || !response.is_of_type<FB::VariantMap>())
+        return response;
+
+    FB::VariantMap result = response.cast<FB::VariantMap>();
+    if (result["error"].convert_cast<bool>()
+        || result.find(field) == result.end())
+        return response;
+
+    FB::variant handle = createHandle(result[field].convert_cast<std::string>())
+        .cast<FB::VariantMap>()["handle"];
+    result[field] = handle;
+    result["handle"] = handle;
+
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::setVerifyCacheSize(long size)
+///
+/// @brief  Sets the maximum number of verification results to keep in the
+///         verify cache, dropping the least recently used entries if the
+///         cache is shrunk. A size of 0 disables the cache.
+///
+/// @param  size    The maximum number of entries.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::setVerifyCacheSize(long size)
+{
+    if (size < 0)
+        return get_error_map(__func__, -1, "The cache size cannot be negative",
+            __LINE__, __FILE__);
+
+    boost::mutex::scoped_lock lock(verify_cache_mutex);
+    verify_cache.set_capacity(size);
+
+    return (long) verify_cache.capacity();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::clearVerifyCache()
+///
+/// @brief  Drops all of the entries in the verify cache.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::clearVerifyCache()
+{
+    boost::mutex::scoped_lock lock(verify_cache_mutex);
+    verify_cache.clear();
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::setDecryptCacheTimeout(long seconds)
+///
+/// @brief  Enables (opt-in) the decrypt cache, which keeps the result of a
+///         successful gpgDecrypt in memory for at most seconds, so that
+///         reopening the same message does not involve gpg, the gpg-agent or
+///         pinentry again. Nothing is written to disk; the cache is wiped on
+///         flushDecryptCache(), when the homedir changes and when the plugin
+///         is released. A value of 0 (the default) disables and wipes it.
+///
+/// @param  seconds The maximum time to keep a decrypted message.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::setDecryptCacheTimeout(long seconds)
+{
+    if (seconds < 0)
+        return get_error_map(__func__, -1, "The timeout cannot be negative",
+            __LINE__, __FILE__);
+
+    boost::mutex::scoped_lock lock(decrypt_cache_mutex);
+    decrypt_cache_timeout = seconds;
+    if (seconds == 0)
+        decrypt_cache.clear();
+
+    return decrypt_cache_timeout;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::flushDecryptCache()
+///
+/// @brief  Overwrites and drops all of the entries in the decrypt cache; this
+///         should be called whenever the user locks their keys.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::flushDecryptCache()
+{
+    boost::mutex::scoped_lock lock(decrypt_cache_mutex);
+    decrypt_cache.clear();
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::get_webpg_status()
+///
+/// @brief  Executes gpgAuthPluginAPI::init() to set the status variables and
+///         populates the "edit_status" property with the transcript of the
+///         edit that completed last.
+///
+/// @returns FB::VariantMap webpg_status_map
+/*! @verbatim
+webpg_status_map {
+    "GNUPGHOME":"",
+    "OpenPGP":{
+        "file_name":"/usr/bin/gpg",
+        "req_version":"1.4.0",
+        "version":"1.4.11"
+    },
+    "edit_status":"",
+    "error":false,
+    "gpg_agent_info":"/tmp/keyring-5FZWyz/gpg:0:1",
+    "gpgconf_detected":true,
+    "gpgme_valid":true,
+    "gpgme_version":"1.3.2",
+    "plugin":{
+        "params":{
+            "id":"gpgAuthPlugin",
+            "type":"application/x-webpg"
+        },
+        "path":"plugins/Linux_x86_64-gcc/npgpgAuthPlugin-v0.6.1.so",
+        "source_url":"_generated_background_page.html",
+        "version":"0.6.1"
+    }
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::VariantMap gpgAuthPluginAPI::get_webpg_status()
+{
+    gpgAuthPluginAPI::init();
+    gpgAuthPluginAPI::webpg_status_map["edit_status"] =
+        edit_events.transcript(edit_events.last_op());
+    return gpgAuthPluginAPI::webpg_status_map;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::getEditEvents(const boost::optional<FB::VariantMap>& options)
+///
+/// @brief  Returns the recorded prompts and responses of the key edits that
+///         ran last. The journal keeps a fixed number of events and edits;
+///         older ones are dropped as new ones are recorded.
+///
+/// @param  options Optional; "after" returns only the events with a seq above
+///         it (pass the "next" value of a previous call to poll for new
+///         events) and "op" only those of that edit.
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "error":false,
+    "next":24,
+    "ops":[
+        {
+            "op":3,
+            "call":"gpgSetKeyTrust(keyid='0x1234567890ABCDEF', trust_level='4');",
+            "started":1318954567,
+            "finished":1318954568,
+            "error":0
+        }
+    ],
+    "events":[
+        {
+            "seq":21,
+            "op":3,
+            "prompt":"keyedit.prompt",
+            "step":1,
+            "response":"trust",
+            "answered":true,
+            "time":1318954567
+        }, ...
+    ]
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::getEditEvents(
+    const boost::optional<FB::VariantMap>& options)
+{
+    FB::VariantMap response;
+    FB::VariantList ops_list, events_list;
+    std::vector<edit_op> ops;
+    std::vector<edit_event> events;
+    unsigned long after = 0, op_id = 0;
+    size_t i;
+
+    if (options) {
+        after = (unsigned long) map_long(*options, "after", 0);
+        op_id = (unsigned long) map_long(*options, "op", 0);
+    }
+
+    edit_events.ops(ops);
+    unsigned long next = edit_events.events(after, op_id, events);
+
+    for (i = 0; i < ops.size(); i++) {
+        if (op_id && ops[i].op_id != op_id)
+            continue;
+        FB::VariantMap op_map;
+        op_map["op"] = (long) ops[i].op_id;
+        op_map["call"] = ops[i].call;
+        op_map["started"] = (long) ops[i].started;
+        op_map["finished"] = (long) ops[i].finished;
+        op_map["error"] = (long) ops[i].error;
+        ops_list.push_back(op_map);
+    }
+
+    for (i = 0; i < events.size(); i++) {
+        FB::VariantMap event_map;
+        event_map["seq"] = (long) events[i].seq;
+        event_map["op"] = (long) events[i].op_id;
+        event_map["step"] = events[i].step;
+        event_map["answered"] = events[i].answered;
+        event_map["time"] = (long) events[i].timestamp;
+        if (events[i].answered) {
+            event_map["prompt"] = edit_prompt_name(events[i].prompt);
+            event_map["response"] = events[i].text;
+        } else {
+            event_map["prompt"] = events[i].text;
+        }
+        events_list.push_back(event_map);
+    }
+
+    response["error"] = false;
+    response["next"] = (long) next - 1;
+    response["ops"] = ops_list;
+    response["events"] = events_list;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::VariantMap gpgAuthPluginAPI::getKeyList(const std::string& name, int secret_only)
+///
+/// @brief  Retrieves all keys matching name, or if name is not specified,
+///         returns all keys in the keyring. The keyring to use is determined
+///         by the integer value of secret_only.
+///
+/// @param  name    Name of key to retrieve
+/// @param  secret_only Return only secret keys (private keyring)
+/// @returns FB::VariantMap keylist_map
+/*! @verbatim
+keylist_map {
+    "1E4F6A67ACD1C298":{
+        "can_authenticate":true,
+        "can_certify":true,
+        "can_encrypt":true,
+        "can_sign":true,
+        "disabled":false,
+        "email":"webpg.extension.devel@curetheitch.com",
+        "expired":false,
+        "fingerprint":"68634186B526CC1F959404401E4F6A67ACD1C298",
+        "invalid":false,
+        "is_qualified":false,
+        "name":"WebPG Testing Key",
+        "owner_trust":"marginal",
+        "protocol":"OpenPGP",
+        "revoked":false,
+        "secret":false,
+        "subkeys":{
+            "0":{
                 "algorithm":1,
                 "algorithm_name":"RSA",
                 "can_authenticate":true,
@@ -1122,7 +2044,7 @@ FB::variant gpgAuthPluginAPI::gpgGetPreference(const std::string& preference)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @fn FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data, const FB::VariantList& enc_to_keyids, bool sign)
+/// @fn FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data, const FB::VariantList& enc_to_keyids, bool sign, const boost::optional<FB::VariantMap>& options)
 ///
 /// @brief  Encrypts the data passed in data with the key ids passed in
 ///         enc_to_keyids and optionally signs the data.
@@ -1130,6 +2052,11 @@ FB::variant gpgAuthPluginAPI::gpgGetPreference(const std::string& preference)
 /// @param  data    The data to encrypt.
 /// @param  enc_to_keyids   A VariantList of key ids to encrypt to (recpients).
 /// @param  sign    The data should be also be signed.
+/// @param  options An optional object. If "binary" is true, the message is
+///                 not armored; the raw OpenPGP packets are base64 encoded
+///                 natively and returned in "data" with "encoding":"base64".
+///                 The result can be passed back to gpgDecrypt with the same
+///                 option.
 ///
 /// @returns FB::variant response
 /*! @verbatim
@@ -1155,8 +2082,18 @@ response {
     and sign [optional; default: 0:NULL:false]
     the return value is a string buffer of the result */
 FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data, 
-        const FB::VariantList& enc_to_keyids, bool sign)
+        const FB::VariantList& enc_to_keyids, bool sign,
+        const boost::optional<FB::VariantMap>& options)
 {
+    boost::optional<FB::VariantMap> rest;
+    std::string handle = handle_option(options, "handle", rest);
+    if (handle.length()) {
+        boost::shared_ptr<std::string> ref = get_handle_data(handle);
+        if (!ref)
+            return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+        return gpgEncrypt(*ref, enc_to_keyids, sign, rest);
+    }
+
     /* declare variables */
     gpgme_ctx_t ctx = get_gpgme_ctx();
     gpgme_error_t err;
@@ -1174,6 +2111,10 @@ FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data,
     gpgme_encrypt_result_t enc_result;
     FB::VariantMap response;
     bool unusable_key = false;
+    bool binary = option_enabled(options, "binary");
+
+    if (binary)
+        gpgme_set_armor (ctx, 0);
 
     err = gpgme_data_new_from_mem (&in, data.c_str(), data.length(), 0);
     if (err != GPG_ERR_NO_ERROR)
@@ -1187,7 +2128,8 @@ FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data,
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    err = gpgme_data_set_encoding(out, GPGME_DATA_ENCODING_ARMOR);
+    err = gpgme_data_set_encoding(out, binary ?
+        GPGME_DATA_ENCODING_BINARY : GPGME_DATA_ENCODING_ARMOR);
     if(err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
@@ -1256,9 +2198,12 @@ FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data,
         //  returned value for actual substance.
         gpgme_data_seek(out, 0, SEEK_SET);
         char buf[513];
-        gpgme_data_read (out, buf, 512);
-        int buflen = strlen(buf);
-        if (buflen < 52) {
+        int buflen = gpgme_data_read (out, buf, 512);
+        if (!binary && buflen >= 0) {
+            buf[buflen] = 0;
+            buflen = strlen(buf);
+        }
+        if ((binary && buflen < 1) || (!binary && buflen < 52)) {
             gpgme_release (ctx);
             gpgme_data_release (in);
             gpgme_data_release (out);
@@ -1281,9 +2226,12 @@ FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data,
 
     size_t out_size = 0;
     std::string out_buf;
-    out_buf = gpgme_data_release_and_get_mem (out, &out_size);
-    /* strip the size_t data out of the output buffer */
-    out_buf = out_buf.substr(0, out_size);
+    char *out_mem = gpgme_data_release_and_get_mem (out, &out_size);
+    /* copy out_size bytes, the output may be binary and contain NULs */
+    if (out_mem) {
+        out_buf.assign(out_mem, out_size);
+        gpgme_free (out_mem);
+    }
     /* set the output object to NULL since it has
         already been released */
     out = NULL;
@@ -1300,14 +2248,19 @@ FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data,
     if (out)
         gpgme_data_release (out);
 
-    response["data"] = out_buf;
+    if (binary) {
+        response["data"] = armor_b64_encode(out_buf);
+        response["encoding"] = "base64";
+    } else {
+        response["data"] = out_buf;
+    }
     response["error"] = false;
 
-    return response;
+    return handle_response(response, options);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @fn FB::variant gpgAuthPluginAPI::gpgSymmetricEncrypt(const std::string& data, bool sign)
+/// @fn FB::variant gpgAuthPluginAPI::gpgSymmetricEncrypt(const std::string& data, bool sign, const boost::optional<FB::VariantMap>& options)
 ///
 /// @brief  Calls gpgAuthPluginAPI::gpgEncrypt() without any recipients specified
 ///         which initiates a Symmetric encryption method on the gpgme context.
@@ -1316,6 +2269,7 @@ FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data,
 /// @param  sign    The data should also be signed. NOTE: Signed symmetric
 ///                 encryption does not work in gpgme v1.3.2; For details,
 ///                 see https://bugs.g10code.com/gnupg/issue1440
+/// @param  options As for gpgAuthPluginAPI::gpgEncrypt().
 ///////////////////////////////////////////////////////////////////////////////
 /*
     This method just calls gpgAuthPlugin.gpgEncrypt without any keys
@@ -1325,114 +2279,662 @@ FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data,
     default: 0:NULL:false].
     the return value is a string buffer of the result */
 FB::variant gpgAuthPluginAPI::gpgSymmetricEncrypt(const std::string& data,
-        bool sign)
+        bool sign, const boost::optional<FB::VariantMap>& options)
 {
     FB::VariantList empty_keys;
-    return gpgAuthPluginAPI::gpgEncrypt(data, empty_keys, sign);
+    return gpgAuthPluginAPI::gpgEncrypt(data, empty_keys, sign, options);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @fn FB::variant gpgAuthPluginAPI::gpgDecryptVerify(const std::string& data, int use_agent)
+/// @fn FB::variant gpgAuthPluginAPI::gpgAddRecipients(const std::string& ciphertext, const FB::VariantList& new_keyids, const boost::optional<FB::VariantMap>& options)
 ///
-/// @brief  Attempts to decrypt and verify the string data. If use_agent
-///         is 0, it will attempt to disable the key-agent to prevent the
-///         passphrase dialog from displaying. This is useful in cases where
-///         you want to verify or decrypt without unlocking the private keyring
-///         (i.e. in an automated parsing environment).
+/// @brief  Produces a copy of ciphertext that can also be decrypted by the
+///         keys in new_keyids. gpgme-1.3.2 gives no access to the session key,
+///         so the existing encrypted data packet cannot be reused; instead the
+///         message is decrypted and encrypted again to its original recipients
+///         (read from the decrypt result) and the new ones entirely inside of
+///         the plugin, and the plaintext is wiped afterwards. An error is
+///         returned if the key of an original recipient is not available, so
+///         nobody loses access. gpg does not return the inner signature of a
+///         signed and encrypted message, so the new message is not signed;
+///         the original signatures are reported and "signature_dropped" is set.
 ///
-/// @param  data    The data to decrypt and/or verify.
-/// @param  use_agent   Attempt to disable the gpg-agent
+/// @param  ciphertext  The encrypted message.
+/// @param  new_keyids  A VariantList of key ids to add as recipients.
+/// @param  options As for gpgAuthPluginAPI::gpgEncrypt(); "binary" applies to
+///                 both the input and the output.
 ///
 /// @returns FB::variant response
 /*! @verbatim
 response {
-    "data":"This is a test of symmetric encrypted data with a signature...\n",
+    "data":"-----BEGIN PGP MESSAGE-----...",
     "error":false,
-    "message_type":"signed_message",
-    "signatures":{
-        "0":{
-            "expiration":"0",
-            "fingerprint":"0C178DD984F837340075BD76C599711F5E82BB93",
-            "status":"GOOD",
-            "timestamp":"1346645718",
-            "validity":"full"
-        }
-    }
+    "recipients":{
+        "0":"5A1B6A81DD9DE6A7E7B3F2A448F6AD9B5E2F3026",
+        "1":"0C178DD984F837340075BD76C599711F5E82BB93"
+    },
+    "signature_dropped":false
 }
 @endverbatim
 */
 ///////////////////////////////////////////////////////////////////////////////
-FB::variant gpgAuthPluginAPI::gpgDecryptVerify(const std::string& data, int use_agent)
+FB::variant gpgAuthPluginAPI::gpgAddRecipients(const std::string& ciphertext,
+    const FB::VariantList& new_keyids, const boost::optional<FB::VariantMap>& options)
 {
-    gpgme_ctx_t ctx;
-    gpgme_error_t err;
-    gpgme_decrypt_result_t decrypt_result;
-    gpgme_verify_result_t verify_result;
-    gpgme_signature_t sig;
-    gpgme_data_t in, out;
-    std::string out_buf;
-    std::string envvar;
-    FB::VariantMap response;
-    int nsigs;
-    int tnsigs = 0;
-    char buf[513];
-    int ret;
+    boost::optional<FB::VariantMap> rest;
+    std::string handle = handle_option(options, "handle", rest);
+    if (handle.length()) {
+        boost::shared_ptr<std::string> ref = get_handle_data(handle);
+        if (!ref)
+            return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+        return gpgAddRecipients(*ref, new_keyids, rest);
+    }
 
-    char *agent_info = getenv("GPG_AGENT_INFO");
+    std::vector<std::string> keyids;
+    size_t i;
 
-    if (use_agent == 0) {
-        // Set the GPG_AGENT_INFO to null because the user shouldn't be bothered with for
-        //  a passphrase if we get a chunk of encrypted data by mistake.
-        setTempGPGOption("batch", "");
-        // Set the defined password to be "", if anything else is sent to the
-        //  agent, this will result in a return error of invalid key when
-        //  performing Symmetric decryption (because the passphrase is the
-        //  secret key)
-        setTempGPGOption("passphrase", "\"\"");
-#ifndef HAVE_W32_SYSTEM
-#ifndef FB_MACOSX
-        // Poison the GPG_AGENT_INFO environment variable
-        envvar = "GPG_AGENT_INFO=INVALID";
-        putenv(strdup(envvar.c_str()));
-#endif
-#endif
-        // Create our context with the above modifications
-        ctx = get_gpgme_ctx();
-        // Set the passphrase callback to just send "\n", which will
-        //  deal with the case there is no gpg-agent
-        gpgme_set_passphrase_cb (ctx, passphrase_cb, NULL);
-    } else {
-        ctx = get_gpgme_ctx();
-    }
+    if (new_keyids.size() < 1)
+        return get_error_map(__func__, -1, "No recipients specified",
+            __LINE__, __FILE__);
 
-    err = gpgme_data_new_from_mem (&in, data.c_str(), data.length(), 0);
-    if (err != GPG_ERR_NO_ERROR) {
-        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    for (i = 0; i < new_keyids.size(); i++)
+        keyids.push_back(new_keyids[i].convert_cast<std::string>());
+
+    return reencryptMessage(ciphertext, keyids, true, options);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgReencryptBatch(const FB::VariantList& items, const FB::VariantList& new_keyids, const boost::optional<FB::VariantMap>& options)
+///
+/// @brief  Queues a background job that decrypts each of the encrypted
+///         messages in items and encrypts it again to new_keyids; the
+///         plaintext is handed from decrypt to encrypt inside of the plugin
+///         and never reaches javascript. The items are processed by a pool of
+///         worker threads, one per core by default (at most 8, and only one
+///         if gpgme was built without thread support). The result
+///         of each item is delivered with the onreencryptprogress event
+///         (job_id, result, completed, total), where result is the
+///         gpgEncrypt response with an added "index" into items. The
+///         onreencryptcomplete event (job_id, status, completed, total) fires
+///         with the status "complete" or "cancelled" once the workers stop;
+///         a complete job is then forgotten. The 8 most recently cancelled
+///         jobs are kept for gpgAuthPluginAPI::gpgResumeReencrypt() until
+///         they are discarded with gpgAuthPluginAPI::gpgDiscardReencrypt().
+///
+/// @param  items   A VariantList of encrypted messages.
+/// @param  new_keyids  A VariantList of key ids to encrypt to.
+/// @param  options An optional object. "keep_recipients" also encrypts to the
+///                 original recipients of each message, "workers" sets the
+///                 number of worker threads and "handles" means that items
+///                 are handles; the other members are as for
+///                 gpgAuthPluginAPI::gpgEncrypt().
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "error":false,
+    "job_id":"reencrypt-1",
+    "status":"queued",
+    "total":2500
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgReencryptBatch(const FB::VariantList& items,
+    const FB::VariantList& new_keyids, const boost::optional<FB::VariantMap>& options)
+{
+    reencryptJobPtr job = boost::make_shared<reencryptJob>();
+    FB::VariantMap response;
+    size_t i;
+
+    if (new_keyids.size() < 1)
+        return get_error_map(__func__, -1, "No recipients specified",
+            __LINE__, __FILE__);
+
+    for (i = 0; i < items.size(); i++) {
+        std::string item = items[i].convert_cast<std::string>();
+        if (option_enabled(options, "handles")) {
+            boost::shared_ptr<std::string> ref = get_handle_data(item);
+            if (!ref)
+                return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, item);
+            item = *ref;
+        }
+        job->items.push_back(item);
     }
+    for (i = 0; i < new_keyids.size(); i++)
+        job->keyids.push_back(new_keyids[i].convert_cast<std::string>());
+    job->keep_recipients = option_enabled(options, "keep_recipients");
+    job->options = options;
+    if (job->options) {
+        // The options are passed on to gpgEncrypt for each item
+        job->options->erase("handles");
+        job->options->erase("handle");
+    }
+    job->total = job->items.size();
+    job->next_item = 0;
+    job->completed = 0;
+    job->failed = 0;
+    job->active_workers = 0;
+    job->cancelled = false;
 
-    err = gpgme_data_new (&out);
-    if (err != GPG_ERR_NO_ERROR) {
-        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    job->max_workers = gpgme_max_workers(options ? map_long(*options, "workers",
+        boost::thread::hardware_concurrency()) : boost::thread::hardware_concurrency());
+
+    {
+        boost::mutex::scoped_lock lock(reencrypt_jobs_mutex);
+        job->job_id = "reencrypt-" + i_to_str(++reencrypt_job_counter);
+        reencrypt_jobs[job->job_id] = job;
     }
 
-    err = gpgme_op_decrypt_verify (ctx, in, out);
+    startReencryptWorkers(job);
 
-    decrypt_result = gpgme_op_decrypt_result (ctx);
-    verify_result = gpgme_op_verify_result (ctx);
+    response["job_id"] = job->job_id;
+    response["status"] = "queued";
+    response["total"] = (long) job->total;
+    response["error"] = false;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn void gpgAuthPluginAPI::startReencryptWorkers(reencryptJobPtr job)
+///
+/// @brief  Starts as many worker threads as job allows, but no more than
+///         there are remaining items; a job without remaining items gets a
+///         single worker so that the completion event still fires.
+///
+/// @param  job The job to start the workers for.
+///////////////////////////////////////////////////////////////////////////////
+void gpgAuthPluginAPI::startReencryptWorkers(reencryptJobPtr job)
+{
+    int nworkers;
+
+    {
+        boost::mutex::scoped_lock lock(job->mutex);
+        size_t remaining = job->total - job->next_item;
+        nworkers = (remaining < (size_t) job->max_workers) ?
+            (int) remaining : job->max_workers;
+        if (nworkers < 1)
+            nworkers = 1;
+        job->active_workers += nworkers;
+    }
+
+    for (int i = 0; i < nworkers; i++) {
+        worker_started();
+        boost::thread reencrypt_thread(
+            boost::bind(
+                &gpgAuthPluginAPI::reencryptThreadCaller,
+                this, job)
+        );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn void gpgAuthPluginAPI::threaded_gpgReencrypt(reencryptJobPtr job)
+///
+/// @brief  Takes the next item from job and re-encrypts it with
+///         gpgAuthPluginAPI::reencryptMessage() until no items are left or
+///         the job is cancelled; the last worker to stop fires the
+///         onreencryptcomplete event.
+///
+/// @param  job The job to work on.
+///////////////////////////////////////////////////////////////////////////////
+void gpgAuthPluginAPI::threaded_gpgReencrypt(reencryptJobPtr job)
+{
+    for (;;) {
+        size_t index;
+        size_t completed;
+        {
+            boost::mutex::scoped_lock lock(job->mutex);
+            if (job->cancelled || job->next_item >= job->total)
+                break;
+            index = job->next_item++;
+        }
+
+        FB::VariantMap result = reencryptMessage(job->items[index],
+            job->keyids, job->keep_recipients, job->options);
+        result["index"] = (long) index;
+
+        {
+            boost::mutex::scoped_lock lock(job->mutex);
+            job->completed++;
+            if (result["error"].convert_cast<bool>())
+                job->failed++;
+            else
+                std::string().swap(job->items[index]);
+            completed = job->completed;
+        }
+
+        FireEvent("onreencryptprogress", FB::variant_list_of(job->job_id)
+            (result)((long) completed)((long) job->total));
+    }
+
+    std::string status;
+    size_t completed;
+    {
+        boost::mutex::scoped_lock lock(job->mutex);
+        if (--job->active_workers > 0)
+            return;
+        status = (job->next_item >= job->total) ? "complete" : "cancelled";
+        completed = job->completed;
+        if (status == "complete") {
+            // Nothing can be resumed; drop the messages
+            job->items.clear();
+        }
+    }
+
+    if (status == "complete") {
+        // Only a cancelled job can be resumed; forget the finished one
+        boost::mutex::scoped_lock lock(reencrypt_jobs_mutex);
+        reencrypt_jobs.erase(job->job_id);
+    } else {
+        // Keep the newest cancelled jobs for gpgResumeReencrypt; the job
+        //  may have been resumed or discarded meanwhile
+        boost::mutex::scoped_lock lock(reencrypt_jobs_mutex);
+        boost::mutex::scoped_lock job_lock(job->mutex);
+        if (job->cancelled && job->active_workers == 0
+            && reencrypt_jobs.count(job->job_id)
+            && std::find(reencrypt_resumable.begin(), reencrypt_resumable.end(),
+                job->job_id) == reencrypt_resumable.end()) {
+            reencrypt_resumable.push_back(job->job_id);
+            while (reencrypt_resumable.size() > reencrypt_max_resumable) {
+                reencrypt_jobs.erase(reencrypt_resumable.front());
+                reencrypt_resumable.pop_front();
+            }
+        }
+    }
+
+    FireEvent("onreencryptcomplete", FB::variant_list_of(job->job_id)
+        (status)((long) completed)((long) job->total));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgCancelReencrypt(const std::string& job_id)
+///
+/// @brief  Cancels a gpgReencryptBatch job; the items being processed are
+///         finished and the job can later be continued with
+///         gpgAuthPluginAPI::gpgResumeReencrypt().
+///
+/// @param  job_id  The id returned by gpgReencryptBatch.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgCancelReencrypt(const std::string& job_id)
+{
+    reencryptJobPtr job;
+    {
+        boost::mutex::scoped_lock lock(reencrypt_jobs_mutex);
+        std::map<std::string, reencryptJobPtr>::iterator it = reencrypt_jobs.find(job_id);
+        if (it == reencrypt_jobs.end())
+            return get_error_map(__func__, -1, "Unknown job", __LINE__, __FILE__, job_id);
+        job = it->second;
+    }
+
+    {
+        boost::mutex::scoped_lock lock(job->mutex);
+        job->cancelled = true;
+    }
+
+    return getReencryptStatus(job_id);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgResumeReencrypt(const std::string& job_id)
+///
+/// @brief  Continues a cancelled gpgReencryptBatch job with the first item
+///         that was not yet started.
+///
+/// @param  job_id  The id returned by gpgReencryptBatch.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgResumeReencrypt(const std::string& job_id)
+{
+    reencryptJobPtr job;
+    {
+        boost::mutex::scoped_lock lock(reencrypt_jobs_mutex);
+        std::map<std::string, reencryptJobPtr>::iterator it = reencrypt_jobs.find(job_id);
+        if (it == reencrypt_jobs.end())
+            return get_error_map(__func__, -1, "Unknown job", __LINE__, __FILE__, job_id);
+        job = it->second;
+
+        boost::mutex::scoped_lock job_lock(job->mutex);
+        if (!job->cancelled || job->active_workers > 0)
+            return get_error_map(__func__, -1,
+                "The job is still running or has not been cancelled",
+                __LINE__, __FILE__, job_id);
+        if (job->next_item >= job->total)
+            return get_error_map(__func__, -1, "The job is complete",
+                __LINE__, __FILE__, job_id);
+        job->cancelled = false;
+        reencrypt_resumable.remove(job_id);
+    }
+
+    startReencryptWorkers(job);
+
+    return getReencryptStatus(job_id);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgDiscardReencrypt(const std::string& job_id)
+///
+/// @brief  Forgets a cancelled gpgReencryptBatch job together with the
+///         messages it has not processed; a running job has to be cancelled
+///         first.
+///
+/// @param  job_id  The id returned by gpgReencryptBatch.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgDiscardReencrypt(const std::string& job_id)
+{
+    FB::VariantMap response;
+    reencryptJobPtr job;
+    {
+        boost::mutex::scoped_lock lock(reencrypt_jobs_mutex);
+        std::map<std::string, reencryptJobPtr>::iterator it = reencrypt_jobs.find(job_id);
+        if (it == reencrypt_jobs.end())
+            return get_error_map(__func__, -1, "Unknown job", __LINE__, __FILE__, job_id);
+        job = it->second;
+
+        boost::mutex::scoped_lock job_lock(job->mutex);
+        if (job->active_workers > 0)
+            return get_error_map(__func__, -1,
+                "The job is still running; cancel it first",
+                __LINE__, __FILE__, job_id);
+        reencrypt_jobs.erase(it);
+        reencrypt_resumable.remove(job_id);
+        job->items.clear();
+    }
+
+    response["job_id"] = job_id;
+    response["status"] = "discarded";
+    response["error"] = false;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::getReencryptStatus(const std::string& job_id)
+///
+/// @brief  Returns the progress of a gpgReencryptBatch job. Once a job has
+///         completed, or was discarded or dropped for a newer cancelled
+///         job, it is no longer known; its result is the
+///         onreencryptcomplete event.
+///
+/// @param  job_id  The id returned by gpgReencryptBatch.
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "completed":1200,
+    "error":false,
+    "failed":3,
+    "job_id":"reencrypt-1",
+    "status":"running",
+    "total":2500,
+    "workers":4
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::getReencryptStatus(const std::string& job_id)
+{
+    reencryptJobPtr job;
+    FB::VariantMap response;
+    {
+        boost::mutex::scoped_lock lock(reencrypt_jobs_mutex);
+        std::map<std::string, reencryptJobPtr>::iterator it = reencrypt_jobs.find(job_id);
+        if (it == reencrypt_jobs.end())
+            return get_error_map(__func__, -1, "Unknown job", __LINE__, __FILE__, job_id);
+        job = it->second;
+    }
+
+    boost::mutex::scoped_lock lock(job->mutex);
+    response["job_id"] = job_id;
+    response["status"] = (job->next_item >= job->total && job->active_workers == 0) ?
+        "complete" : !job->cancelled ? "running" :
+        (job->active_workers > 0) ? "cancelling" : "cancelled";
+    response["completed"] = (long) job->completed;
+    response["failed"] = (long) job->failed;
+    response["total"] = (long) job->total;
+    response["workers"] = job->active_workers;
+    response["error"] = false;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::VariantMap gpgAuthPluginAPI::reencryptMessage(const std::string& ciphertext, const std::vector<std::string>& keyids, bool keep_recipients, const boost::optional<FB::VariantMap>& options)
+///
+/// @brief  Decrypts ciphertext and encrypts the plaintext again to keyids
+///         and, if keep_recipients is set, to the original recipients; the
+///         plaintext never leaves this method and is wiped before returning.
+///         This is safe to call from worker threads.
+///
+/// @param  ciphertext  The encrypted message.
+/// @param  keyids  The key ids to encrypt to.
+/// @param  keep_recipients Also encrypt to the original recipients.
+/// @param  options As for gpgAuthPluginAPI::gpgEncrypt().
+///////////////////////////////////////////////////////////////////////////////
+FB::VariantMap gpgAuthPluginAPI::reencryptMessage(const std::string& ciphertext,
+    const std::vector<std::string>& new_keyids, bool keep_recipients,
+    const boost::optional<FB::VariantMap>& options)
+{
+    gpgme_ctx_t ctx;
+    gpgme_error_t err;
+    gpgme_data_t in, out;
+    gpgme_decrypt_result_t decrypt_result;
+    gpgme_verify_result_t verify_result;
+    gpgme_recipient_t recipient;
+    gpgme_key_t key;
+    std::vector<std::string> keyids;
+    std::vector<std::string> fingerprints;
+    FB::VariantList enc_to_keyids;
+    FB::VariantMap recipients_map;
+    FB::VariantMap signatures;
+    FB::VariantMap response;
+    std::string packets;
+    std::string plaintext;
+    const std::string* in_data = &ciphertext;
+    size_t out_size = 0;
+    char *out_mem;
+    size_t i;
+
+    if (option_enabled(options, "binary")) {
+        if (!armor_b64_decode(ciphertext.c_str(), ciphertext.length(), packets))
+            return get_error_map(__func__, -1, "The binary data is not base64 encoded",
+                __LINE__, __FILE__);
+        in_data = &packets;
+    }
+
+    ctx = get_gpgme_ctx();
+
+    err = gpgme_data_new_from_mem (&in, in_data->c_str(), in_data->length(), 0);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_release (ctx);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    err = gpgme_data_new (&out);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_data_release (in);
+        gpgme_release (ctx);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    err = gpgme_op_decrypt_verify (ctx, in, out);
+    gpgme_data_release (in);
+
+    out_mem = gpgme_data_release_and_get_mem (out, &out_size);
+    if (out_mem) {
+        plaintext.assign(out_mem, out_size);
+        memset(out_mem, 0, out_size);
+        gpgme_free (out_mem);
+    }
+
+    decrypt_result = gpgme_op_decrypt_result (ctx);
+    if (err != GPG_ERR_NO_ERROR || !decrypt_result) {
+        scrub_string(plaintext);
+        gpgme_release (ctx);
+        if (err == GPG_ERR_NO_ERROR)
+            err = gpgme_error (GPG_ERR_NO_DATA);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    verify_result = gpgme_op_verify_result (ctx);
+    if (verify_result && verify_result->signatures)
+        signatures = get_signatures_map(verify_result);
+
+    // The original recipients, followed by the new ones
+    if (keep_recipients) {
+        for (recipient = decrypt_result->recipients; recipient; recipient = recipient->next)
+            keyids.push_back(nonnull (recipient->keyid));
+    }
+    keyids.insert(keyids.end(), new_keyids.begin(), new_keyids.end());
+
+    // Resolve each key id to its key so recipients are listed only once
+    for (i = 0; i < keyids.size(); i++) {
+        err = gpgme_get_key (ctx, keyids[i].c_str(), &key, 0);
+        if (err != GPG_ERR_NO_ERROR) {
+            scrub_string(plaintext);
+            gpgme_release (ctx);
+            return get_error_map(__func__, gpgme_err_code (err),
+                "The key of a recipient is not available", __LINE__, __FILE__,
+                keyids[i]);
+        }
+        std::string fpr = nonnull (key->subkeys->fpr);
+        gpgme_key_unref (key);
+        if (std::find(fingerprints.begin(), fingerprints.end(), fpr) == fingerprints.end()) {
+            recipients_map[i_to_str(fingerprints.size())] = fpr;
+            fingerprints.push_back(fpr);
+            enc_to_keyids.push_back(fpr);
+        }
+    }
+    gpgme_release (ctx);
+
+    FB::variant result = gpgEncrypt(plaintext, enc_to_keyids, false, options);
+    scrub_string(plaintext);
+
+    response = result.cast<FB::VariantMap>();
+    if (response["error"].convert_cast<bool>())
+        return response;
+
+    response["recipients"] = recipients_map;
+    response["signature_dropped"] = signatures.size() > 0;
+    if (signatures.size())
+        response["signatures"] = signatures;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgDecryptVerify(const std::string& data, int use_agent)
+///
+/// @brief  Attempts to decrypt and verify the string data. If use_agent
+///         is 0, only a verify operation is performed; encrypted data is
+///         refused before gpg is started and any passphrase request is
+///         refused, so the passphrase dialog is never displayed.
+///         This is useful in cases where you want to verify without
+///         unlocking the private keyring (i.e. in an automated parsing
+///         environment). No gpg.conf or environment changes are made, so
+///         concurrent calls are safe.
+///
+/// @param  data    The data to decrypt and/or verify.
+/// @param  use_agent   Use 0 to verify without invoking the gpg-agent
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "data":"This is a test of symmetric encrypted data with a signature...\n",
+    "error":false,
+    "message_type":"signed_message",
+    "signatures":{
+        "0":{
+            "expiration":"0",
+            "fingerprint":"0C178DD984F837340075BD76C599711F5E82BB93",
+            "status":"GOOD",
+            "timestamp":"1346645718",
+            "validity":"full"
+        }
+    }
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgDecryptVerify(const std::string& data, int use_agent)
+{
+    gpgme_ctx_t ctx;
+    gpgme_error_t err;
+    gpgme_decrypt_result_t decrypt_result;
+    gpgme_verify_result_t verify_result;
+    gpgme_signature_t sig;
+    gpgme_data_t in, out;
+    std::string out_buf;
+    FB::VariantMap response;
+    int nsigs = 0;
+    int tnsigs = 0;
+    char buf[512];
+    int ret;
+    std::string cache_key;
+    std::string cache_stamp;
+    time_t cache_expires = 0;
 
     if (use_agent == 0) {
-        // Restore the gpg.conf options
-        restoreGPGConfig();
-        // Restore GPG_AGENT_INFO to its original value
-#ifndef HAVE_W32_SYSTEM
-#ifndef FB_MACOSX
-        envvar = "GPG_AGENT_INFO=";
-        envvar += agent_info;
-        putenv(strdup(envvar.c_str()));
-#endif
-#endif
+        // gpg decrypts encrypted input even for a verify operation, which
+        //  would involve the agent and pinentry; refuse it before gpg runs
+        if (armor_is_encrypted(data))
+            return get_error_map(__func__, GPG_ERR_NO_DATA,
+                "The data is encrypted; it cannot be verified without decryption",
+                __LINE__, __FILE__);
+
+        // Signed data that was already verified against the current keyring
+        //  and trustdb does not need another trip through gpg
+        FB::variant cached;
+        cache_key = sha256_hex(data);
+        cache_stamp = get_keyring_stamp();
+        boost::mutex::scoped_lock lock(verify_cache_mutex);
+        if (verify_cache.get(cache_key, cache_stamp, cached))
+            return cached;
+    } else {
+        // A message decrypted earlier is served from memory while the
+        //  decrypt cache is enabled
+        boost::mutex::scoped_lock lock(decrypt_cache_mutex);
+        if (decrypt_cache_timeout > 0) {
+            decryptCacheEntry entry;
+            cache_key = sha256_hex(data);
+            cache_stamp = get_keyring_stamp();
+            if (decrypt_cache.get(cache_key, cache_stamp, entry)) {
+                response = entry.result;
+                response["data"] = entry.data;
+                scrub_decrypt_entry(entry);
+                return response;
+            }
+        }
     }
 
+    ctx = get_gpgme_ctx();
+
+    if (use_agent == 0) {
+        // Encrypted data was refused above; should gpg still find something
+        //  to decrypt, refuse any passphrase request made on this context
+        //  instead of answering it.
+        gpgme_set_passphrase_cb (ctx, passphrase_cb, NULL);
+    }
+
+    err = gpgme_data_new_from_mem (&in, data.c_str(), data.length(), 0);
+    if (err != GPG_ERR_NO_ERROR) {
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    err = gpgme_data_new (&out);
+    if (err != GPG_ERR_NO_ERROR) {
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    if (use_agent == 0) {
+        err = gpgme_op_verify (ctx, in, NULL, out);
+    } else {
+        err = gpgme_op_decrypt_verify (ctx, in, out);
+    }
+
+    decrypt_result = gpgme_op_decrypt_result (ctx);
+    verify_result = gpgme_op_verify_result (ctx);
+
     if (err != GPG_ERR_NO_ERROR && !verify_result) {
         // There was an error returned while decrypting;
         //   either bad data, or signed only data
@@ -1456,27 +2958,13 @@ FB::variant gpgAuthPluginAPI::gpgDecryptVerify(const std::string& data, int use_
         }
     }
 
-    FB::VariantMap signatures;
+    FB::VariantMap signatures = get_signatures_map(verify_result);
     if (verify_result && verify_result->signatures) {
         tnsigs = 0;
         for (nsigs=0, sig=verify_result->signatures; sig; sig = sig->next, nsigs++) {
-            FB::VariantMap signature;
-            signature["fingerprint"] = nonnull (sig->fpr);
-            signature["timestamp"] = sig->timestamp;
-            signature["expiration"] = sig->exp_timestamp;
-            signature["validity"] = sig->validity == GPGME_VALIDITY_UNKNOWN? "unknown":
-                    sig->validity == GPGME_VALIDITY_UNDEFINED? "undefined":
-                    sig->validity == GPGME_VALIDITY_NEVER? "never":
-                    sig->validity == GPGME_VALIDITY_MARGINAL? "marginal":
-                    sig->validity == GPGME_VALIDITY_FULL? "full":
-                    sig->validity == GPGME_VALIDITY_ULTIMATE? "ultimate": "[?]";
-            signature["status"] = gpg_err_code (sig->status) == GPG_ERR_NO_ERROR? "GOOD":
-                    gpg_err_code (sig->status) == GPG_ERR_BAD_SIGNATURE? "BAD_SIG":
-                    gpg_err_code (sig->status) == GPG_ERR_NO_PUBKEY? "NO_PUBKEY":
-                    gpg_err_code (sig->status) == GPG_ERR_NO_DATA? "NO_SIGNATURE":
-                    gpg_err_code (sig->status) == GPG_ERR_SIG_EXPIRED? "GOOD_EXPSIG":
-                    gpg_err_code (sig->status) == GPG_ERR_KEY_EXPIRED? "GOOD_EXPKEY": "INVALID";
-            signatures[i_to_str(nsigs)] = signature;
+            if (sig->exp_timestamp && (!cache_expires
+                || (time_t) sig->exp_timestamp < cache_expires))
+                cache_expires = sig->exp_timestamp;
             tnsigs++;
         }
     }
@@ -1506,8 +2994,11 @@ FB::variant gpgAuthPluginAPI::gpgDecryptVerify(const std::string& data, int use_
         if (ret)
             return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
+        /* append ret bytes, the output may be binary */
         while ((ret = gpgme_data_read (out, buf, 512)) > 0)
-            out_buf += buf;
+            out_buf.append(buf, ret);
+
+        gpgme_data_release (out);
 
         if (ret < 0)
             return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
@@ -1515,14 +3006,7 @@ FB::variant gpgAuthPluginAPI::gpgDecryptVerify(const std::string& data, int use_
         if (out_buf.length() < 1) {
             response["data"] = data;
             response["message_type"] = "detached_signature";
-            gpgme_data_release (out);
         } else {
-            size_t out_size = 0;
-            gpgme_data_seek(out, 0, SEEK_SET);
-            out_buf = gpgme_data_release_and_get_mem (out, &out_size);
-
-            /* strip the size_t data out of the output buffer */
-            out_buf = out_buf.substr(0, out_size);
             response["data"] = out_buf;
         }
 
@@ -1533,29 +3017,619 @@ FB::variant gpgAuthPluginAPI::gpgDecryptVerify(const std::string& data, int use_
     gpgme_data_release (in);
     gpgme_release (ctx);
 
+    if (use_agent == 0 && tnsigs > 0) {
+        boost::mutex::scoped_lock lock(verify_cache_mutex);
+        verify_cache.put(cache_key, cache_stamp, cache_expires, response);
+    } else if (use_agent == 1 && cache_key.length() && decrypt_result
+        && err == GPG_ERR_NO_ERROR) {
+        boost::mutex::scoped_lock lock(decrypt_cache_mutex);
+        if (decrypt_cache_timeout > 0) {
+            decryptCacheEntry entry;
+            entry.data = out_buf;
+            entry.result = response;
+            entry.result.erase("data");
+            decrypt_cache.put(cache_key, cache_stamp,
+                time(NULL) + decrypt_cache_timeout, entry);
+            scrub_decrypt_entry(entry);
+        }
+    }
+
     return response;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @fn FB::variant gpgAuthPluginAPI::gpgDecrypt(const std::string& data)
+/// @fn FB::variant gpgAuthPluginAPI::gpgDecrypt(const std::string& data, const boost::optional<FB::VariantMap>& options)
 ///
 /// @brief  Calls gpgAuthPluginAPI::gpgDecryptVerify() with the use_agent flag
 ///         specifying to not disable the gpg-agent.
 ///
 /// @param  data    The data to decyrpt.
+/// @param  options An optional object. If "binary" is true, data holds base64
+///                 encoded binary OpenPGP packets (as returned by gpgEncrypt
+///                 with the same option), which are decoded natively first.
 ///////////////////////////////////////////////////////////////////////////////
-FB::variant gpgAuthPluginAPI::gpgDecrypt(const std::string& data)
+FB::variant gpgAuthPluginAPI::gpgDecrypt(const std::string& data,
+    const boost::optional<FB::VariantMap>& options)
 {
-    return gpgAuthPluginAPI::gpgDecryptVerify(data, 1);
+    boost::optional<FB::VariantMap> rest;
+    std::string handle = handle_option(options, "handle", rest);
+    if (handle.length()) {
+        boost::shared_ptr<std::string> ref = get_handle_data(handle);
+        if (!ref)
+            return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+        return gpgDecrypt(*ref, rest);
+    }
+
+    if (option_enabled(options, "binary")) {
+        std::string packets;
+        if (!armor_b64_decode(data.c_str(), data.length(), packets))
+            return get_error_map(__func__, -1, "The binary data is not base64 encoded",
+                __LINE__, __FILE__);
+        return handle_response(gpgAuthPluginAPI::gpgDecryptVerify(packets, 1), options);
+    }
+
+    return handle_response(gpgAuthPluginAPI::gpgDecryptVerify(data, 1), options);
 }
 
-FB::variant gpgAuthPluginAPI::gpgVerify(const std::string& data)
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgVerify(const std::string& data, const boost::optional<FB::VariantMap>& options)
+///
+/// @brief  Calls gpgAuthPluginAPI::gpgDecryptVerify() with the use_agent flag
+///         specifying to only verify, or gpgAuthPluginAPI::gpgVerifyOnly() if
+///         the plaintext is not wanted.
+///
+/// @param  data    The data to verify.
+/// @param  options An optional object. "binary" is as for gpgDecrypt. If
+///                 "verify_only" is true, the signed content is not returned;
+///                 with "content_hash" also set, its SHA-256 is returned in
+///                 "content_hash" instead.
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgVerify(const std::string& data,
+    const boost::optional<FB::VariantMap>& options)
 {
-    return gpgAuthPluginAPI::gpgDecryptVerify(data, 0);
+    boost::optional<FB::VariantMap> rest;
+    std::string handle = handle_option(options, "handle", rest);
+    if (handle.length()) {
+        boost::shared_ptr<std::string> ref = get_handle_data(handle);
+        if (!ref)
+            return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+        return gpgVerify(*ref, rest);
+    }
+
+    std::string packets;
+    const std::string* in = &data;
+
+    if (option_enabled(options, "binary")) {
+        if (!armor_b64_decode(data.c_str(), data.length(), packets))
+            return get_error_map(__func__, -1, "The binary data is not base64 encoded",
+                __LINE__, __FILE__);
+        in = &packets;
+    }
+
+    if (option_enabled(options, "verify_only"))
+        return gpgAuthPluginAPI::gpgVerifyOnly(*in,
+            option_enabled(options, "content_hash"));
+
+    return handle_response(gpgAuthPluginAPI::gpgDecryptVerify(*in, 0), options);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgVerifyOnly(const std::string& data, bool content_hash)
+///
+/// @brief  Verifies the clear signed or inline signed message in data without
+///         building a plaintext buffer; gpg is given an output sink that
+///         discards the signed content or, if content_hash is set, only
+///         computes its SHA-256. The caller already has the text, so only
+///         the signature results are returned. Encrypted data is refused
+///         before gpg is started. Results are kept in the verify cache.
+///
+/// @param  data    The signed message.
+/// @param  content_hash    Return the SHA-256 of the signed content.
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "content_hash":"3a6eb0790f39ac87c94f3856b2dd2c5d110e6811602261a9a923d3bb23adc8b7",
+    "error":false,
+    "message_type":"signed_message",
+    "signatures":{
+        "0":{
+            "expiration":"0",
+            "fingerprint":"0C178DD984F837340075BD76C599711F5E82BB93",
+            "status":"GOOD",
+            "timestamp":"1346645718",
+            "validity":"full"
+        }
+    }
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgVerifyOnly(const std::string& data,
+    bool content_hash)
+{
+    gpgme_ctx_t ctx;
+    gpgme_error_t err;
+    gpgme_data_t in, out;
+    gpgme_verify_result_t verify_result;
+    gpgme_signature_t sig;
+    struct gpgme_data_cbs hash_cbs = { NULL, hash_sink_write, NULL, NULL };
+    struct gpgme_data_cbs discard_cbs = { NULL, discard_sink_write, NULL, NULL };
+    sha256_ctx hash;
+    FB::VariantMap response;
+    std::string cache_key;
+    std::string cache_stamp;
+    time_t cache_expires = 0;
+
+    // The verify operation would decrypt encrypted input; refuse it here
+    if (armor_is_encrypted(data))
+        return get_error_map(__func__, GPG_ERR_NO_DATA,
+            "The data is encrypted; it cannot be verified without decryption",
+            __LINE__, __FILE__);
+
+    sha256_init(hash);
+    sha256_update(hash, content_hash ? "verify_only+hash:" : "verify_only:",
+        content_hash ? 17 : 12);
+    sha256_update(hash, data.data(), data.length());
+    cache_key = sha256_final(hash);
+    cache_stamp = get_keyring_stamp();
+    {
+        FB::variant cached;
+        boost::mutex::scoped_lock lock(verify_cache_mutex);
+        if (verify_cache.get(cache_key, cache_stamp, cached))
+            return cached;
+    }
+
+    ctx = get_gpgme_ctx();
+    gpgme_set_passphrase_cb (ctx, passphrase_cb, NULL);
+
+    err = gpgme_data_new_from_mem (&in, data.c_str(), data.length(), 0);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_release (ctx);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    // gpgme requires an output for a clear signed or inline signed message
+    if (content_hash) {
+        sha256_init(hash);
+        err = gpgme_data_new_from_cbs (&out, &hash_cbs, &hash);
+    } else {
+        err = gpgme_data_new_from_cbs (&out, &discard_cbs, NULL);
+    }
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_data_release (in);
+        gpgme_release (ctx);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    err = gpgme_op_verify (ctx, in, NULL, out);
+    verify_result = gpgme_op_verify_result (ctx);
+
+    if (err != GPG_ERR_NO_ERROR || !verify_result || !verify_result->signatures) {
+        if (err == GPG_ERR_NO_ERROR)
+            err = gpgme_error (GPG_ERR_NO_DATA);
+        response = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    } else {
+        for (sig = verify_result->signatures; sig; sig = sig->next) {
+            if (sig->exp_timestamp && (!cache_expires
+                || (time_t) sig->exp_timestamp < cache_expires))
+                cache_expires = sig->exp_timestamp;
+        }
+        response["signatures"] = get_signatures_map(verify_result);
+        response["message_type"] = "signed_message";
+        if (content_hash)
+            response["content_hash"] = sha256_final(hash);
+        response["error"] = false;
+    }
+
+    gpgme_data_release (in);
+    gpgme_data_release (out);
+    gpgme_release (ctx);
+
+    if (!response["error"].convert_cast<bool>()) {
+        boost::mutex::scoped_lock lock(verify_cache_mutex);
+        verify_cache.put(cache_key, cache_stamp, cache_expires, response);
+    }
+
+    return response;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @fn FB::variant gpgAuthPluginAPI::gpgSignText(FB::VariantList& signers, const std::string& plain_text, int sign_mode)
+/// @fn FB::variant gpgAuthPluginAPI::gpgDecryptPreview(const std::string& data, long max_bytes, const boost::optional<FB::VariantMap>& options)
+///
+/// @brief  Decrypts data into a bounded output sink which keeps only the first
+///         max_bytes of plaintext; as soon as more is produced the sink fails
+///         the write, gpgme cancels the rest of the operation and only the
+///         prefix is returned. A trailing partial UTF-8 character is dropped.
+///         Since gpg checks signatures at the end of the message, no
+///         signatures are reported for a truncated preview. A message in the
+///         decrypt cache is previewed from memory.
+///
+/// @param  data    The data to decrypt.
+/// @param  max_bytes   The maximum number of bytes of plaintext to return.
+/// @param  options An optional object; "handle" names a handle to read the
+///                 data from (see gpgAuthPluginAPI::createHandle()).
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "data":"This is the start of a long encrypted mes",
+    "error":false,
+    "message_type":"encrypted_message",
+    "truncated":true
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgDecryptPreview(const std::string& data,
+    long max_bytes, const boost::optional<FB::VariantMap>& options)
+{
+    boost::optional<FB::VariantMap> rest;
+    std::string handle = handle_option(options, "handle", rest);
+    if (handle.length()) {
+        boost::shared_ptr<std::string> ref = get_handle_data(handle);
+        if (!ref)
+            return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+        return gpgDecryptPreview(*ref, max_bytes, rest);
+    }
+
+    gpgme_ctx_t ctx;
+    gpgme_error_t err;
+    gpgme_data_t in, out;
+    struct gpgme_data_cbs sink_cbs = { NULL, bounded_sink_write, NULL, NULL };
+    boundedSink sink;
+    FB::VariantMap response;
+
+    if (max_bytes < 1)
+        return get_error_map(__func__, -1, "max_bytes must be greater than 0",
+            __LINE__, __FILE__);
+
+    {
+        boost::mutex::scoped_lock lock(decrypt_cache_mutex);
+        decryptCacheEntry entry;
+        if (decrypt_cache_timeout > 0 && decrypt_cache.get(sha256_hex(data),
+            get_keyring_stamp(), entry)) {
+            response["truncated"] = entry.data.length() > (size_t) max_bytes;
+            entry.data.erase(std::min(entry.data.length(), (size_t) max_bytes));
+            trim_partial_utf8(entry.data);
+            response["data"] = entry.data;
+            response["message_type"] = "encrypted_message";
+            response["error"] = false;
+            scrub_decrypt_entry(entry);
+            return response;
+        }
+    }
+
+    sink.max_bytes = max_bytes;
+    sink.truncated = false;
+
+    ctx = get_gpgme_ctx();
+
+    err = gpgme_data_new_from_mem (&in, data.c_str(), data.length(), 0);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_release (ctx);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    err = gpgme_data_new_from_cbs (&out, &sink_cbs, &sink);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_data_release (in);
+        gpgme_release (ctx);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    err = gpgme_op_decrypt (ctx, in, out);
+
+    gpgme_data_release (in);
+    gpgme_data_release (out);
+    gpgme_release (ctx);
+
+    // The write error raised by the sink is expected once the preview is full
+    if (err != GPG_ERR_NO_ERROR && !sink.truncated)
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+
+    trim_partial_utf8(sink.data);
+    response["data"] = sink.data;
+    response["truncated"] = sink.truncated;
+    response["message_type"] = "encrypted_message";
+    response["error"] = false;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgVerifyDetached(const std::string& signed_data, const std::string& signature, const boost::optional<FB::VariantMap>& options)
+///
+/// @brief  Verifies a detached signature against the data it was made over
+///         with a single gpgme_op_verify call; the signed data is handed to
+///         gpg as is and no plaintext output buffer is created. Like
+///         gpgVerify, no passphrase is ever requested and the result is kept
+///         in the verify cache.
+///
+/// @param  signed_data The data the signature was made over.
+/// @param  signature   The detached signature, armored or (with the
+///                     "binary" option) base64 encoded OpenPGP packets.
+/// @param  options An optional object; see gpgAuthPluginAPI::gpgVerify().
+///                 "handle" and "signature_handle" name handles to read the
+///                 signed data and the signature from.
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "error":false,
+    "message_type":"detached_signature",
+    "signatures":{
+        "0":{
+            "expiration":"0",
+            "fingerprint":"0C178DD984F837340075BD76C599711F5E82BB93",
+            "status":"GOOD",
+            "timestamp":"1346645718",
+            "validity":"full"
+        }
+    }
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgVerifyDetached(const std::string& signed_data,
+    const std::string& signature, const boost::optional<FB::VariantMap>& options)
+{
+    boost::optional<FB::VariantMap> rest;
+    std::string handle = handle_option(options, "handle", rest);
+    if (handle.length()) {
+        boost::shared_ptr<std::string> ref = get_handle_data(handle);
+        if (!ref)
+            return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+        return gpgVerifyDetached(*ref, signature, rest);
+    }
+    handle = handle_option(options, "signature_handle", rest);
+    if (handle.length()) {
+        boost::shared_ptr<std::string> ref = get_handle_data(handle);
+        if (!ref)
+            return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+        return gpgVerifyDetached(signed_data, *ref, rest);
+    }
+
+    gpgme_ctx_t ctx;
+    gpgme_error_t err;
+    gpgme_data_t sig_data, text_data;
+    gpgme_verify_result_t verify_result;
+    gpgme_signature_t sig;
+    FB::VariantMap response;
+    std::string sig_packets;
+    const std::string* sig_in = &signature;
+    std::string cache_key;
+    std::string cache_stamp;
+    time_t cache_expires = 0;
+    sha256_ctx hash;
+
+    if (option_enabled(options, "binary")) {
+        if (!armor_b64_decode(signature.c_str(), signature.length(), sig_packets))
+            return get_error_map(__func__, -1, "The binary data is not base64 encoded",
+                __LINE__, __FILE__);
+        sig_in = &sig_packets;
+    }
+
+    // The cache key covers both the signature and the signed data
+    sha256_init(hash);
+    sha256_update(hash, "detached:", 9);
+    sha256_update(hash, sha256_hex(*sig_in).c_str(), 64);
+    sha256_update(hash, signed_data.data(), signed_data.length());
+    cache_key = sha256_final(hash);
+    cache_stamp = get_keyring_stamp();
+    {
+        FB::variant cached;
+        boost::mutex::scoped_lock lock(verify_cache_mutex);
+        if (verify_cache.get(cache_key, cache_stamp, cached))
+            return cached;
+    }
+
+    ctx = get_gpgme_ctx();
+    gpgme_set_passphrase_cb (ctx, passphrase_cb, NULL);
+
+    err = gpgme_data_new_from_mem (&sig_data, sig_in->c_str(), sig_in->length(), 0);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_release (ctx);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    err = gpgme_data_new_from_mem (&text_data, signed_data.c_str(), signed_data.length(), 0);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_data_release (sig_data);
+        gpgme_release (ctx);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    err = gpgme_op_verify (ctx, sig_data, text_data, NULL);
+    verify_result = gpgme_op_verify_result (ctx);
+
+    if (err != GPG_ERR_NO_ERROR || !verify_result || !verify_result->signatures) {
+        if (err == GPG_ERR_NO_ERROR)
+            err = gpgme_error (GPG_ERR_NO_DATA);
+        response = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    } else {
+        for (sig = verify_result->signatures; sig; sig = sig->next) {
+            if (sig->exp_timestamp && (!cache_expires
+                || (time_t) sig->exp_timestamp < cache_expires))
+                cache_expires = sig->exp_timestamp;
+        }
+        response["signatures"] = get_signatures_map(verify_result);
+        response["message_type"] = "detached_signature";
+        response["error"] = false;
+    }
+
+    gpgme_data_release (sig_data);
+    gpgme_data_release (text_data);
+    gpgme_release (ctx);
+
+    if (!response["error"].convert_cast<bool>()) {
+        boost::mutex::scoped_lock lock(verify_cache_mutex);
+        verify_cache.put(cache_key, cache_stamp, cache_expires, response);
+    }
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::classifyPGPData(const std::string& data, const boost::optional<FB::VariantMap>& options)
+///
+/// @brief  Locates the first OpenPGP armored block in data and reports what
+///         it contains by parsing the armor and packet headers natively; gpg
+///         is never invoked and no keyring is consulted. Recipients are taken
+///         from the public-key encrypted session key packets and signers from
+///         the signature and one-pass signature packets. The packets inside
+///         a compressed message are not inflated, so signers of a compressed
+///         signed message are not reported.
+///
+/// @param  data    The text to inspect.
+/// @param  options An optional object; "handle" names a handle to read the
+///                 text from.
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "armor_label":"MESSAGE",
+    "begin":0,
+    "clearsigned":false,
+    "crc_valid":true,
+    "end":1261,
+    "error":false,
+    "has_crc":true,
+    "headers":{
+        "Version":"GnuPG v1.4.11 (GNU/Linux)"
+    },
+    "message_type":"encrypted_message",
+    "recipients":{
+        "0":"9E274A8EC24BE06B",
+        "1":"5858CD12C1971CC1"
+    },
+    "signers":{},
+    "symmetric":false
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::classifyPGPData(const std::string& data,
+    const boost::optional<FB::VariantMap>& options)
+{
+    boost::optional<FB::VariantMap> rest;
+    std::string handle = handle_option(options, "handle", rest);
+    if (handle.length()) {
+        boost::shared_ptr<std::string> ref = get_handle_data(handle);
+        if (!ref)
+            return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+        return classifyPGPData(*ref, rest);
+    }
+
+    FB::VariantMap response;
+    armor_block block;
+
+    if (!armor_find_block(data, 0, block)) {
+        response["error"] = false;
+        response["message_type"] = "unknown";
+        return response;
+    }
+
+    response = get_armor_info_map(armor_classify(data, block), block);
+    response["error"] = false;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::processPGPBlocks(const std::string& text, const std::string& mode)
+///
+/// @brief  Scans text for all OpenPGP armored blocks (quoted replies, several
+///         signed sections, etc.) and processes each of them, so that a page
+///         containing many blocks is handled with a single call. Every block
+///         is classified natively as with classifyPGPData(); encrypted and
+///         signed messages are then passed to gpgDecryptVerify() according
+///         to mode. Key blocks and unrecognized blocks are only classified.
+///         The begin and end offsets of each block index into text.
+///
+/// @param  text    The text to scan.
+/// @param  mode    One of "classify", "verify" (verify only, the gpg-agent
+///                 is not invoked and encrypted messages are reported with
+///                 "verified":false without running gpg) or "decrypt"
+///                 (decrypt and verify).
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "blocks":{
+        "0":{
+            "armor_label":"SIGNED MESSAGE",
+            "begin":112,
+            "end":845,
+            "message_type":"signed_message",
+            ...
+            "result":{
+                "data":"...",
+                "error":false,
+                "message_type":"signed_message",
+                "signatures":{...}
+            }
+        }
+    },
+    "count":1,
+    "error":false
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::processPGPBlocks(const std::string& text,
+    const std::string& mode)
+{
+    FB::VariantMap response;
+    FB::VariantMap blocks_map;
+    armor_block block;
+    std::string::size_type pos = 0;
+    int use_agent;
+    int nblocks = 0;
+
+    if (mode == "classify")
+        use_agent = -1;
+    else if (mode == "verify")
+        use_agent = 0;
+    else if (mode == "decrypt")
+        use_agent = 1;
+    else
+        return get_error_map(__func__, -1, "Unknown mode; expected "
+            "classify, verify or decrypt", __LINE__, __FILE__);
+
+    while (armor_find_block(text, pos, block)) {
+        armor_info info = armor_classify(text, block);
+        FB::VariantMap block_map = get_armor_info_map(info, block);
+
+        if (use_agent == 0 && info.message_type == "encrypted_message") {
+            // Verifying an encrypted message requires decrypting it; report
+            //  it without starting gpg for a NO_DATA result
+            FB::VariantMap result;
+            result["error"] = false;
+            result["message_type"] = info.message_type;
+            result["verified"] = false;
+            result["result"] = "Encrypted messages are not processed in verify mode";
+            block_map["result"] = result;
+        } else if (use_agent >= 0 && (info.message_type == "encrypted_message"
+            || info.message_type == "signed_message"
+            || info.message_type == "compressed_message")) {
+            block_map["result"] = gpgDecryptVerify(
+                text.substr(block.begin, block.end - block.begin), use_agent);
+        }
+
+        blocks_map[i_to_str(nblocks++)] = block_map;
+        pos = block.end;
+    }
+
+    response["blocks"] = blocks_map;
+    response["count"] = nblocks;
+    response["error"] = false;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgSignText(FB::VariantList& signers, const std::string& plain_text, int sign_mode, const boost::optional<FB::VariantMap>& options)
 ///
 /// @brief  Signs the text specified in plain_text with the key ids specified
 ///         in signers, with the signature mode specified in sign_mode.
@@ -1563,6 +3637,10 @@ FB::variant gpgAuthPluginAPI::gpgVerify(const std::string& data)
 /// @param  signers    The key ids to sign with.
 /// @param  plain_text    The data to sign.
 /// @param  sign_mode   The GPGME_SIG_MODE to use for signing.
+/// @param  options An optional object. If "binary" is true, a normal or
+///                 detached signature is returned as base64 encoded OpenPGP
+///                 packets with "encoding":"base64"; clear signed text is
+///                 always returned as is.
 ///
 /// @returns FB::variant response
 /*! @verbatim
@@ -1594,8 +3672,17 @@ response {
         2: GPGME_SIG_MODE_CLEAR
 */
 FB::variant gpgAuthPluginAPI::gpgSignText(const FB::VariantList& signers, const std::string& plain_text,
-    int sign_mode)
+    int sign_mode, const boost::optional<FB::VariantMap>& options)
 {
+    boost::optional<FB::VariantMap> rest;
+    std::string handle = handle_option(options, "handle", rest);
+    if (handle.length()) {
+        boost::shared_ptr<std::string> ref = get_handle_data(handle);
+        if (!ref)
+            return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+        return gpgSignText(signers, *ref, sign_mode, rest);
+    }
+
     gpgme_ctx_t ctx = get_gpgme_ctx();
     gpgme_error_t err;
     gpgme_data_t in, out;
@@ -1605,6 +3692,10 @@ FB::variant gpgAuthPluginAPI::gpgSignText(const FB::VariantList& signers, const
     int nsigners;
     FB::variant signer;
     FB::VariantMap result;
+    bool binary = option_enabled(options, "binary") && sign_mode != 2;
+
+    if (binary)
+        gpgme_set_armor (ctx, 0);
 
     if (sign_mode == 0)
         sig_mode = GPGME_SIG_MODE_NORMAL;
@@ -1659,21 +3750,455 @@ FB::variant gpgAuthPluginAPI::gpgSignText(const FB::VariantList& signers, const
 
     size_t out_size = 0;
     std::string out_buf;
-    out_buf = gpgme_data_release_and_get_mem (out, &out_size);
-    /* strip the size_t data out of the output buffer */
-    out_buf = out_buf.substr(0, out_size);
+    char *out_mem = gpgme_data_release_and_get_mem (out, &out_size);
+    /* copy out_size bytes, the output may be binary and contain NULs */
+    if (out_mem) {
+        out_buf.assign(out_mem, out_size);
+        gpgme_free (out_mem);
+    }
     /* set the output object to NULL since it has
         already been released */
     out = NULL;
 
     result["error"] = false;
-    result["data"] = out_buf;
+    if (binary) {
+        result["data"] = armor_b64_encode(out_buf);
+        result["encoding"] = "base64";
+    } else {
+        result["data"] = out_buf;
+    }
 
     gpgme_data_release (in);
     gpgme_release (ctx);
 
-    return result;
+    return handle_response(result, options);
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgSignMulti(const std::string& data, const FB::VariantList& signers, int sign_mode, const boost::optional<FB::VariantMap>& options)
+///
+/// @brief  Creates an independent signature over data for each of the keys
+///         in signers. Each signature is made in its own context on its own
+///         thread, so the call takes about as long as the slowest signature
+///         rather than the sum of them. At most 8 signatures are made at a
+///         time, and only one if gpgme was built without thread support.
+///
+/// @param  data    The data to sign.
+/// @param  signers The key ids to sign with.
+/// @param  sign_mode   The GPGME_SIG_MODE to use for signing; 1 (detached)
+///                     is the usual choice.
+/// @param  options An optional object, passed to gpgAuthPluginAPI::gpgSignText()
+///                 for each signature.
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "error":false,
+    "failed":0,
+    "signatures":[
+        {
+            "data":"—————BEGIN PGP SIGNATURE—————...",
+            "error":false,
+            "signer":"0DF9C95C3BE1A023"
+        },
+        {
+            "data":"—————BEGIN PGP SIGNATURE—————...",
+            "error":false,
+            "signer":"5EBB2B7F1E7194EC"
+        }
+    ]
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgSignMulti(const std::string& data,
+    const FB::VariantList& signers, int sign_mode,
+    const boost::optional<FB::VariantMap>& options)
+{
+    boost::optional<FB::VariantMap> rest;
+    std::string handle = handle_option(options, "handle", rest);
+    if (handle.length()) {
+        boost::shared_ptr<std::string> ref = get_handle_data(handle);
+        if (!ref)
+            return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+        return gpgSignMulti(*ref, signers, sign_mode, rest);
+    }
+
+    FB::VariantMap response;
+    FB::VariantList signatures;
+    std::vector<FB::variant> results(signers.size());
+    boost::thread_group workers;
+    size_t i, failed = 0;
+    size_t nworkers = gpgme_max_workers((long) signers.size());
+
+    if (signers.empty())
+        return get_error_map(__func__, -1, "No signing keys found", __LINE__, __FILE__);
+
+    for (i = 0; i < signers.size(); i++) {
+        signMultiParams params;
+        params.signer.push_back(signers[i]);
+        params.data = &data;
+        params.sign_mode = sign_mode;
+        params.options = options;
+        params.result = &results[i];
+
+        workers.create_thread(boost::bind(
+            &gpgAuthPluginAPI::signMultiThreadCaller, this, params));
+
+        // Wait for each group of nworkers signatures before the next
+        if ((i + 1) % nworkers == 0)
+            workers.join_all();
+    }
+
+    workers.join_all();
+
+    for (i = 0; i < signers.size(); i++) {
+        FB::VariantMap signature = results[i].cast<FB::VariantMap>();
+        if (signature["error"].convert_cast<bool>())
+            failed++;
+        signature["signer"] = signers[i];
+        signatures.push_back(signature);
+    }
+
+    response["signatures"] = signatures;
+    response["failed"] = (long) failed;
+    response["error"] = false;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn void gpgAuthPluginAPI::threaded_gpgSignMulti(signMultiParams params)
+///
+/// @brief  Calls gpgAuthPluginAPI::gpgSignText() with the single signer in
+///         params and stores the response in params.result.
+///
+/// @param  params  The signature to create.
+///////////////////////////////////////////////////////////////////////////////
+void gpgAuthPluginAPI::threaded_gpgSignMulti(signMultiParams params)
+{
+    *params.result = gpgSignText(params.signer, *params.data,
+        params.sign_mode, params.options);
+}
+
+// The opaque handed to file_progress_cb
+struct fileOpProgress {
+    gpgAuthPluginAPI* api;
+    const fileOpParams* params;
+    double file_size;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn void gpgAuthPluginAPI::file_progress_cb(void *self, const char *what, int type, int current, int total)
+///
+/// @brief  Called by gpgme with the progress reported by gpg while it reads
+///         the input file; fires the onfileprogress event with the operation,
+///         the input path, current, total and the size of the input file.
+///
+/// @param  self    A reference to the fileOpProgress of the operation.
+/// @param  what    The current action status from gpg.
+/// @param  type    The type of of action.
+/// @param  current The amount processed so far.
+/// @param  total   The total amount to process, if known.
+///////////////////////////////////////////////////////////////////////////////
+void gpgAuthPluginAPI::file_progress_cb(void *self, const char *what, int type,
+    int current, int total)
+{
+    fileOpProgress* progress = (fileOpProgress*) self;
+
+    progress->api->FireEvent("onfileprogress",
+        FB::variant_list_of(progress->params->operation)
+            (progress->params->in_path)(current)(total)(progress->file_size));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::VariantMap gpgAuthPluginAPI::gpgFileWorker(const fileOpParams& params)
+///
+/// @brief  Runs the file based operation described by params. Both files are
+///         handed to gpgme with gpgme_data_new_from_fd, so gpg reads and
+///         writes them directly and memory use does not depend on the size of
+///         the files. The output is binary (not armored) unless a clear
+///         signature was requested. The output is written to a temporary
+///         file next to out_path which replaces out_path only on success,
+///         so a failed operation leaves an existing out_path untouched.
+///
+/// @param  params  The operation, paths, key ids and signing options.
+///////////////////////////////////////////////////////////////////////////////
+FB::VariantMap gpgAuthPluginAPI::gpgFileWorker(const fileOpParams& params)
+{
+    gpgme_ctx_t ctx;
+    gpgme_error_t err;
+    gpgme_data_t in = NULL, out = NULL;
+    std::vector<gpgme_key_t> keys;
+    fileOpProgress progress;
+    FB::VariantMap response;
+    struct stat in_stat;
+    std::string tmp_path;
+    int in_fd, out_fd;
+    size_t i;
+
+    if (same_file(params.in_path, params.out_path))
+        return get_error_map(__func__, -1,
+            "The input and output files must be different",
+            __LINE__, __FILE__, params.out_path);
+
+    in_fd = open(params.in_path.c_str(), O_RDONLY | O_BINARY);
+    if (in_fd < 0) {
+        err = gpgme_err_code_from_errno(errno);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err),
+            __LINE__, __FILE__, params.in_path);
+    }
+
+    out_fd = open_temp_beside(params.out_path, tmp_path);
+    if (out_fd < 0) {
+        err = gpgme_err_code_from_errno(errno);
+        close(in_fd);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err),
+            __LINE__, __FILE__, params.out_path);
+    }
+
+    ctx = get_gpgme_ctx();
+    gpgme_set_textmode (ctx, 0);
+    gpgme_set_armor (ctx, 0);
+
+    progress.api = this;
+    progress.params = &params;
+    progress.file_size = (fstat(in_fd, &in_stat) == 0) ?
+        (double) in_stat.st_size : 0;
+    gpgme_set_progress_cb (ctx, file_progress_cb, &progress);
+
+    err = gpgme_data_new_from_fd (&in, in_fd);
+    if (err == GPG_ERR_NO_ERROR)
+        err = gpgme_data_new_from_fd (&out, out_fd);
+
+    if (err == GPG_ERR_NO_ERROR && params.operation != "decrypt") {
+        // Look up the recipients or signers
+        for (i = 0; i < params.keyids.size(); i++) {
+            gpgme_key_t key;
+            err = gpgme_get_key (ctx, params.keyids[i].c_str(), &key,
+                params.operation == "sign");
+            if (err != GPG_ERR_NO_ERROR) {
+                response = get_error_map(__func__, gpgme_err_code (err),
+                    gpgme_strerror (err), __LINE__, __FILE__, params.keyids[i]);
+                break;
+            }
+            keys.push_back(key);
+            if (params.operation == "sign")
+                gpgme_signers_add (ctx, key);
+        }
+    }
+
+    if (err == GPG_ERR_NO_ERROR) {
+        if (params.operation == "encrypt") {
+            // Store the name of the input file in the literal data packet
+            std::string::size_type sep = params.in_path.find_last_of("/\\");
+            gpgme_data_set_file_name (in, params.in_path.substr(
+                (sep == std::string::npos) ? 0 : sep + 1).c_str());
+
+            keys.push_back(NULL);
+            if (params.sign)
+                err = gpgme_op_encrypt_sign (ctx, &keys[0],
+                    GPGME_ENCRYPT_ALWAYS_TRUST, in, out);
+            else
+                err = gpgme_op_encrypt (ctx, &keys[0],
+                    GPGME_ENCRYPT_ALWAYS_TRUST, in, out);
+            keys.pop_back();
+        } else if (params.operation == "decrypt") {
+            err = gpgme_op_decrypt_verify (ctx, in, out);
+            if (err == GPG_ERR_NO_ERROR)
+                response["signatures"] = get_signatures_map(
+                    gpgme_op_verify_result (ctx));
+        } else {
+            gpgme_sig_mode_t sig_mode = (params.sign_mode == 1) ?
+                GPGME_SIG_MODE_DETACH : (params.sign_mode == 2) ?
+                GPGME_SIG_MODE_CLEAR : GPGME_SIG_MODE_NORMAL;
+            if (sig_mode == GPGME_SIG_MODE_DETACH)
+                gpgme_set_armor (ctx, 1);
+            err = gpgme_op_sign (ctx, in, out, sig_mode);
+        }
+
+        if (err != GPG_ERR_NO_ERROR)
+            response = get_error_map(__func__, gpgme_err_code (err),
+                gpgme_strerror (err), __LINE__, __FILE__);
+    } else if (!response.size()) {
+        response = get_error_map(__func__, gpgme_err_code (err),
+            gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    if (params.operation == "encrypt" && err == GPG_ERR_NO_ERROR) {
+        gpgme_encrypt_result_t enc_result = gpgme_op_encrypt_result (ctx);
+        if (enc_result && enc_result->invalid_recipients) {
+            err = enc_result->invalid_recipients->reason;
+            response = get_error_map(__func__, gpgme_err_code (err),
+                gpgme_strerror (err), __LINE__, __FILE__,
+                nonnull (enc_result->invalid_recipients->fpr));
+        }
+    }
+
+    for (i = 0; i < keys.size(); i++)
+        gpgme_key_unref (keys[i]);
+    if (in)
+        gpgme_data_release (in);
+    if (out)
+        gpgme_data_release (out);
+    gpgme_release (ctx);
+    close(in_fd);
+    close(out_fd);
+
+    if (response.find("error") == response.end()
+        || !response["error"].convert_cast<bool>()) {
+        if (replace_file(tmp_path, params.out_path) == 0) {
+            response["error"] = false;
+        } else {
+            err = gpgme_err_code_from_errno(errno);
+            response = get_error_map(__func__, gpgme_err_code (err),
+                gpgme_strerror (err), __LINE__, __FILE__, params.out_path);
+        }
+    }
+    if (response["error"].convert_cast<bool>())
+        unlink(tmp_path.c_str());
+    response["operation"] = params.operation;
+    response["in_path"] = params.in_path;
+    response["out_path"] = params.out_path;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn void gpgAuthPluginAPI::threaded_gpgFileOperation(fileOpParams params)
+///
+/// @brief  Calls gpgAuthPluginAPI::gpgFileWorker() with the specified
+///         parameters and fires the onfilecomplete event with the result.
+///
+/// @param  params   The parameters of the file operation.
+///////////////////////////////////////////////////////////////////////////////
+void gpgAuthPluginAPI::threaded_gpgFileOperation(fileOpParams params)
+{
+    FB::VariantMap result = gpgAuthPluginAPI::gpgFileWorker(params);
+
+    FireEvent("onfilecomplete", FB::variant_list_of(result));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgEncryptFile(const std::string& in_path, const std::string& out_path, const FB::VariantList& enc_to_keyids, bool sign)
+///
+/// @brief  Queues a threaded operation that encrypts the file at in_path to
+///         the key ids in enc_to_keyids and writes the binary OpenPGP message
+///         to out_path. gpg reads and writes the files directly, so large
+///         files never pass through the browser. Progress is reported with
+///         the onfileprogress event and the result with onfilecomplete.
+///
+/// @param  in_path The file to encrypt.
+/// @param  out_path    The file to write the encrypted message to.
+/// @param  enc_to_keyids   A VariantList of key ids to encrypt to (recpients).
+/// @param  sign    The data should be also be signed.
+///
+/// @returns FB::variant "queued" or an error map if no recipients were given
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgEncryptFile(const std::string& in_path,
+    const std::string& out_path, const FB::VariantList& enc_to_keyids,
+    bool sign)
+{
+    fileOpParams params;
+    size_t i;
+
+    if (enc_to_keyids.size() < 1)
+        return get_error_map(__func__, -1, "No recipients specified",
+            __LINE__, __FILE__);
+
+    params.operation = "encrypt";
+    params.in_path = in_path;
+    params.out_path = out_path;
+    for (i = 0; i < enc_to_keyids.size(); i++)
+        params.keyids.push_back(enc_to_keyids[i].convert_cast<std::string>());
+    params.sign = sign;
+    params.sign_mode = 0;
+
+    worker_started();
+    boost::thread file_thread(
+        boost::bind(
+            &gpgAuthPluginAPI::fileOpThreadCaller,
+            this, params)
+    );
+
+    return "queued";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgDecryptFile(const std::string& in_path, const std::string& out_path)
+///
+/// @brief  Queues a threaded operation that decrypts and verifies the file at
+///         in_path and writes the plaintext to out_path. The onfilecomplete
+///         event carries the "signatures" map as returned by gpgDecrypt.
+///
+/// @param  in_path The file to decrypt.
+/// @param  out_path    The file to write the plaintext to.
+///
+/// @returns FB::variant "queued"
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgDecryptFile(const std::string& in_path,
+    const std::string& out_path)
+{
+    fileOpParams params;
+
+    params.operation = "decrypt";
+    params.in_path = in_path;
+    params.out_path = out_path;
+    params.sign = false;
+    params.sign_mode = 0;
+
+    worker_started();
+    boost::thread file_thread(
+        boost::bind(
+            &gpgAuthPluginAPI::fileOpThreadCaller,
+            this, params)
+    );
+
+    return "queued";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgSignFile(const std::string& in_path, const std::string& out_path, const FB::VariantList& signers, int sign_mode)
+///
+/// @brief  Queues a threaded operation that signs the file at in_path with
+///         the key ids in signers and writes the result to out_path. A
+///         detached signature (sign_mode 1) is written armored.
+///
+/// @param  in_path The file to sign.
+/// @param  out_path    The file to write the signed data or signature to.
+/// @param  signers The key ids to sign with.
+/// @param  sign_mode   The GPGME_SIG_MODE to use for signing.
+///
+/// @returns FB::variant "queued" or an error map if no signers were given
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgSignFile(const std::string& in_path,
+    const std::string& out_path, const FB::VariantList& signers,
+    int sign_mode)
+{
+    fileOpParams params;
+    size_t i;
+
+    if (signers.size() < 1)
+        return get_error_map(__func__, -1, "No signing keys found",
+            __LINE__, __FILE__);
+
+    params.operation = "sign";
+    params.in_path = in_path;
+    params.out_path = out_path;
+    for (i = 0; i < signers.size(); i++)
+        params.keyids.push_back(signers[i].convert_cast<std::string>());
+    params.sign = true;
+    params.sign_mode = sign_mode;
+
+    worker_started();
+    boost::thread file_thread(
+        boost::bind(
+            &gpgAuthPluginAPI::fileOpThreadCaller,
+            this, params)
+    );
 
+    return "queued";
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1697,8 +4222,13 @@ FB::variant gpgAuthPluginAPI::gpgSignUID(const std::string& keyid, long sign_uid
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap result;
-    current_uid = i_to_str(sign_uid);
+    std::string uid = i_to_str(sign_uid);
+    edit_command& command = edit_add_command(state, "sign", "fpr",
+        uid.c_str(), "tlsign");
+    command.report_status = true;
+    command.passphrase_error = true;
 
     /* set the default key to the with_keyid 
         gpgSetPreference returns the orginal value (if any) of
@@ -1719,51 +4249,384 @@ FB::variant gpgAuthPluginAPI::gpgSignUID(const std::string& keyid, long sign_uid
     if (err != GPG_ERR_NO_ERROR)
         result = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    err = gpgme_op_keylist_next (ctx, &key);
-    if (err != GPG_ERR_NO_ERROR)
-        result = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    err = gpgme_op_keylist_next (ctx, &key);
+    if (err != GPG_ERR_NO_ERROR)
+        result = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+
+    err = gpgme_op_keylist_end (ctx);
+    if (err != GPG_ERR_NO_ERROR)
+        result = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+
+    err = gpgme_data_new (&out);
+    if (err != GPG_ERR_NO_ERROR)
+        result = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+
+    state.op_id = edit_events.begin("gpgSignUID(keyid='" + keyid + "', sign_uid='" + i_to_str(sign_uid) + 
+        "', with_keyid='" + with_keyid + "', local_only='" + i_to_str(local_only) + "', trust_sign='" + 
+        i_to_str(trust_sign) + "', trust_level='" + i_to_str(trust_level) + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
+    if (err != GPG_ERR_NO_ERROR)
+        result = sign_uid_error_map(__func__, err, __LINE__);
+
+    /* if the original value was not empty, reset it to the previous value */
+    if (strcmp ((char *) original_value.c_str(), "0")) {
+        gpgAuthPluginAPI::gpgSetPreference("default-key", original_value);
+    }
+
+    FB::VariantMap response;
+    response["error"] = false;
+    response["result"] = "success";
+
+    gpgme_data_release (out);
+    gpgme_key_unref (key);
+    gpgme_release (ctx);
+
+    if (result.size())
+        return result;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgSignUIDBatch(const FB::VariantList& items, const std::string& with_keyid, const boost::optional<FB::VariantMap>& options)
+///
+/// @brief  Queues a background job that signs many UIDs with the key
+///         with_keyid, as after a keysigning party. All target keys are
+///         looked up in a single key listing and the UIDs of each key are
+///         signed in one edit; the keys are processed by a pool of worker
+///         threads, one per core by default (at most 8, and only one if
+///         gpgme was built without thread support). The result of each
+///         item is delivered with the onsignuidprogress event (job_id,
+///         result, completed, total), where result is the gpgSignUID
+///         response with the added "index", "keyid" and "uid" of the item;
+///         "keyid" is the fingerprint of the key if it was found. Items that
+///         name the same key in different forms are signed in one edit.
+///         Once all keys are done the trustdb is checked a single time and
+///         the onsignuidcomplete event (job_id, status, completed, failed,
+///         total) fires.
+///
+/// @param  items   A VariantList of objects with the "keyid" of the key to
+///                 sign and the index "uid" of the UID on it, as for
+///                 gpgAuthPluginAPI::gpgSignUID(); key ids must be given in
+///                 hex (8 or 16 digits) or as the fingerprint.
+/// @param  with_keyid  The ID of the key to create the signatures with.
+/// @param  options An optional object. "workers" sets the number of worker
+///                 threads; "check_trustdb" set to false skips the trustdb
+///                 check at the end.
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "error":false,
+    "job_id":"signuid-1",
+    "keys":212,
+    "status":"queued",
+    "total":240
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgSignUIDBatch(const FB::VariantList& items,
+    const std::string& with_keyid, const boost::optional<FB::VariantMap>& options)
+{
+    signUIDJobPtr job = boost::make_shared<signUIDJob>();
+    std::map<std::string, size_t> key_index;
+    std::vector<const char *> patterns;
+    std::vector<bool> ambiguous;
+    gpgme_ctx_t ctx;
+    gpgme_error_t err;
+    gpgme_key_t key;
+    gpgme_subkey_t subkey;
+    FB::VariantMap response;
+    size_t i;
+
+    if (items.empty())
+        return get_error_map(__func__, -1, "No items specified", __LINE__, __FILE__);
+
+    for (i = 0; i < items.size(); i++) {
+        if (!items[i].is_of_type<FB::VariantMap>())
+            return get_error_map(__func__, -1, "Items must be objects", __LINE__, __FILE__);
+
+        FB::VariantMap item = items[i].cast<FB::VariantMap>();
+        std::string keyid = map_string(item, "keyid");
+        long uid = map_long(item, "uid", -1);
+
+        if (keyid.substr(0, 2) == "0x" || keyid.substr(0, 2) == "0X")
+            keyid = keyid.substr(2);
+        for (size_t c = 0; c < keyid.length(); c++)
+            keyid[c] = toupper(keyid[c]);
+        if ((keyid.length() != 8 && keyid.length() != 16 && keyid.length() != 40)
+            || keyid.find_first_not_of("0123456789ABCDEF") != std::string::npos)
+            return get_error_map(__func__, -1, "Key ids must be given in hex: " + map_string(item, "keyid"), __LINE__, __FILE__);
+        if (uid < 1)
+            return get_error_map(__func__, -1, "A valid uid is required for " + keyid, __LINE__, __FILE__);
+
+        if (key_index.find(keyid) == key_index.end()) {
+            key_index[keyid] = job->keyids.size();
+            job->keyids.push_back(keyid);
+            job->key_items.push_back(std::vector<size_t>());
+        }
+        job->key_items[key_index[keyid]].push_back(i);
+        job->uids.push_back(uid);
+    }
+
+    job->with_keyid = with_keyid;
+    job->signer = NULL;
+    job->keys.assign(job->keyids.size(), (gpgme_key_t) NULL);
+    job->key_errors.assign(job->keyids.size(), std::string());
+    ambiguous.assign(job->keyids.size(), false);
+
+    ctx = get_gpgme_ctx();
+
+    err = gpgme_get_key (ctx, with_keyid.c_str(), &job->signer, 1);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_release (ctx);
+        return get_error_map(__func__, gpgme_err_code (err), "Unable to find the signing key: " + std::string(gpgme_strerror (err)), __LINE__, __FILE__);
+    }
+
+    // Resolve all target keys with one listing
+    for (i = 0; i < job->keyids.size(); i++)
+        patterns.push_back(job->keyids[i].c_str());
+    patterns.push_back(NULL);
+
+    err = gpgme_op_keylist_ext_start (ctx, &patterns[0], 0, 0);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_key_unref (job->signer);
+        gpgme_release (ctx);
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+    }
+
+    while (!(err = gpgme_op_keylist_next (ctx, &key))) {
+        for (subkey = key->subkeys; subkey; subkey = subkey->next) {
+            if (!subkey->fpr)
+                continue;
+            std::string fpr = subkey->fpr;
+            static const size_t lengths[] = { 8, 16, 40 };
+            for (size_t l = 0; l < 3; l++) {
+                if (fpr.length() < lengths[l])
+                    continue;
+                std::map<std::string, size_t>::iterator it =
+                    key_index.find(fpr.substr(fpr.length() - lengths[l]));
+                if (it == key_index.end())
+                    continue;
+                if (job->keys[it->second] && job->keys[it->second] != key) {
+                    ambiguous[it->second] = true;
+                } else if (!job->keys[it->second]) {
+                    gpgme_key_ref (key);
+                    job->keys[it->second] = key;
+                }
+            }
+        }
+        gpgme_key_unref (key);
+    }
+    gpgme_op_keylist_end (ctx);
+    gpgme_release (ctx);
+
+    for (i = 0; i < job->keyids.size(); i++) {
+        if (ambiguous[i]) {
+            gpgme_key_unref (job->keys[i]);
+            job->keys[i] = NULL;
+            job->key_errors[i] = "The key id " + job->keyids[i] + " matches more than one key";
+        } else if (!job->keys[i]) {
+            job->key_errors[i] = "No public key found for " + job->keyids[i];
+        }
+    }
+
+    // Items may name one key in different forms (short id, long id or
+    //  fingerprint); merge them on the fingerprint of the key found, so that
+    //  each key is edited in a single session
+    {
+        std::map<std::string, size_t> fpr_index;
+        std::vector<std::string> keyids;
+        std::vector<gpgme_key_t> keys;
+        std::vector<std::string> key_errors;
+        std::vector<std::vector<size_t> > key_items;
+
+        for (i = 0; i < job->keyids.size(); i++) {
+            if (!job->keys[i]) {
+                keyids.push_back(job->keyids[i]);
+                keys.push_back(NULL);
+                key_errors.push_back(job->key_errors[i]);
+                key_items.push_back(job->key_items[i]);
+                continue;
+            }
+
+            std::string fpr = job->keys[i]->subkeys->fpr;
+            std::map<std::string, size_t>::iterator it = fpr_index.find(fpr);
+            if (it == fpr_index.end()) {
+                fpr_index[fpr] = keyids.size();
+                keyids.push_back(fpr);
+                keys.push_back(job->keys[i]);
+                key_errors.push_back(std::string());
+                key_items.push_back(job->key_items[i]);
+            } else {
+                gpgme_key_unref (job->keys[i]);
+                key_items[it->second].insert(key_items[it->second].end(),
+                    job->key_items[i].begin(), job->key_items[i].end());
+            }
+        }
+
+        job->keyids.swap(keyids);
+        job->keys.swap(keys);
+        job->key_errors.swap(key_errors);
+        job->key_items.swap(key_items);
+    }
+
+    job->check_trustdb = !options || options->find("check_trustdb") == options->end()
+        || option_enabled(options, "check_trustdb");
+    job->total = items.size();
+    job->next_key = 0;
+    job->completed = 0;
+    job->failed = 0;
+
+    int nworkers = gpgme_max_workers(options ? map_long(*options, "workers",
+        boost::thread::hardware_concurrency()) : boost::thread::hardware_concurrency());
+    if (nworkers > (int) job->keyids.size())
+        nworkers = (int) job->keyids.size();
+    job->active_workers = nworkers;
+
+    {
+        boost::mutex::scoped_lock lock(sign_uid_jobs_mutex);
+        job->job_id = "signuid-" + i_to_str(++sign_uid_job_counter);
+    }
+
+    for (int w = 0; w < nworkers; w++) {
+        worker_started();
+        boost::thread sign_thread(
+            boost::bind(
+                &gpgAuthPluginAPI::signUIDThreadCaller,
+                this, job)
+        );
+    }
+
+    response["job_id"] = job->job_id;
+    response["status"] = "queued";
+    response["keys"] = (long) job->keyids.size();
+    response["total"] = (long) job->total;
+    response["error"] = false;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn void gpgAuthPluginAPI::threaded_gpgSignUIDBatch(signUIDJobPtr job)
+///
+/// @brief  Takes the next target key from job and signs all of its listed
+///         UIDs in one edit until no keys are left. The signing key is
+///         passed to gpg as the signer of the context, so that the
+///         default-key preference does not have to be changed. The last
+///         worker to stop checks the trustdb, releases the keys and fires
+///         the onsignuidcomplete event.
+///
+/// @param  job The job to work on.
+///////////////////////////////////////////////////////////////////////////////
+void gpgAuthPluginAPI::threaded_gpgSignUIDBatch(signUIDJobPtr job)
+{
+    gpgme_ctx_t ctx = get_gpgme_ctx();
+    gpgme_error_t err;
+    size_t i;
+
+    gpgme_signers_add (ctx, job->signer);
+
+    for (;;) {
+        size_t key_idx;
+        {
+            if (is_shutting_down())
+                break;
+            boost::mutex::scoped_lock lock(job->mutex);
+            if (job->next_key >= job->keyids.size())
+                break;
+            key_idx = job->next_key++;
+        }
+
+        const std::vector<size_t>& key_items = job->key_items[key_idx];
+        edit_state state;
+        err = GPG_ERR_NO_ERROR;
+
+        if (job->keys[key_idx]) {
+            gpgme_data_t out = NULL;
+            std::string uids;
+
+            for (i = 0; i < key_items.size(); i++) {
+                std::string uid = "uid " + i_to_str(job->uids[key_items[i]]);
+                edit_command& command = edit_add_command(state, "sign",
+                    "uid 0", uid.c_str(), "tlsign");
+                command.report_status = true;
+                command.passphrase_error = true;
+                uids += (i ? "," : "") + i_to_str(job->uids[key_items[i]]);
+            }
+            // A final command that cannot be refused, so that a refused
+            //  UID fails only its own item
+            edit_add_command(state, "clear", "uid 0");
+
+            err = gpgme_data_new (&out);
+            if (err == GPG_ERR_NO_ERROR) {
+                state.op_id = edit_events.begin("gpgSignUIDBatch(keyid='" + job->keyids[key_idx] +
+                    "', uids='" + uids + "', with_keyid='" + job->with_keyid + "');");
+                err = gpgme_op_edit (ctx, job->keys[key_idx], edit_fnc, &state, out);
+                edit_events.finish(state.op_id, err);
+                gpgme_data_release (out);
+            }
+        }
 
-    err = gpgme_op_keylist_end (ctx);
-    if (err != GPG_ERR_NO_ERROR)
-        result = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+        for (i = 0; i < key_items.size(); i++) {
+            FB::VariantMap result;
+            size_t completed;
 
-    err = gpgme_data_new (&out);
-    if (err != GPG_ERR_NO_ERROR)
-        result = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+            if (!job->keys[key_idx]) {
+                result = get_error_map(__func__, GPG_ERR_NO_PUBKEY, job->key_errors[key_idx], __LINE__, __FILE__);
+            } else if (err != GPG_ERR_NO_ERROR) {
+                result = sign_uid_error_map(__func__, err, __LINE__);
+            } else if (state.refused.count(i)) {
+                result = sign_uid_error_map(__func__, state.refused[i], __LINE__);
+            } else {
+                result["error"] = false;
+                result["result"] = "success";
+            }
+            result["index"] = (long) key_items[i];
+            result["keyid"] = job->keyids[key_idx];
+            result["uid"] = job->uids[key_items[i]];
+
+            {
+                boost::mutex::scoped_lock lock(job->mutex);
+                job->completed++;
+                if (result["error"].convert_cast<bool>())
+                    job->failed++;
+                completed = job->completed;
+            }
 
-    edit_status = "gpgSignUID(keyid='" + keyid + "', sign_uid='" + i_to_str(sign_uid) + 
-        "', with_keyid='" + with_keyid + "', local_only='" + i_to_str(local_only) + "', trust_sign='" + 
-        i_to_str(trust_sign) + "', trust_level='" + i_to_str(trust_level) + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_sign, out, out);
-    if (err != GPG_ERR_NO_ERROR) {
-        if (err == GPGME_STATUS_ALREADY_SIGNED) {
-            result = get_error_map(__func__, err, "The selected UID has already been signed with this key.", __LINE__, __FILE__);
-        } else if (err == GPGME_STATUS_KEYEXPIRED) {
-            result =  get_error_map(__func__, err, "This key is expired; You cannot sign using an expired key.", __LINE__, __FILE__);
-        } else if (err == GPGME_STATUS_SIGEXPIRED) {
-            result =  get_error_map(__func__, err, "This key is expired; You cannot sign using an expired key.", __LINE__, __FILE__);
-        } else {
-            result = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+            FireEvent("onsignuidprogress", FB::variant_list_of(job->job_id)
+                (result)((long) completed)((long) job->total));
         }
     }
 
-    /* if the original value was not empty, reset it to the previous value */
-    if (strcmp ((char *) original_value.c_str(), "0")) {
-        gpgAuthPluginAPI::gpgSetPreference("default-key", original_value);
-    }
+    gpgme_release (ctx);
 
-    FB::VariantMap response;
-    response["error"] = false;
-    response["result"] = "success";
+    {
+        boost::mutex::scoped_lock lock(job->mutex);
+        if (--job->active_workers > 0)
+            return;
+    }
 
-    gpgme_data_release (out);
-    gpgme_key_unref (key);
-    gpgme_release (ctx);
+    // gpg only marks the trustdb for a check when a key is signed; check
+    //  it once for the whole job
+    if (job->check_trustdb && job->completed > job->failed) {
+        std::string output;
+        run_gpg("--check-trustdb", "", output);
+    }
 
-    if (result.size())
-        return result;
+    for (i = 0; i < job->keys.size(); i++) {
+        if (job->keys[i])
+            gpgme_key_unref (job->keys[i]);
+    }
+    job->keys.clear();
+    gpgme_key_unref (job->signer);
+    job->signer = NULL;
 
-    return response;
+    FireEvent("onsignuidcomplete", FB::variant_list_of(job->job_id)
+        ("complete")((long) job->completed)((long) job->failed)
+        ((long) job->total));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1779,8 +4642,11 @@ FB::variant gpgAuthPluginAPI::gpgEnableKey(const std::string& keyid)
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap response;
 
+    edit_add_command(state, "enable", "enable");
+
     err = gpgme_op_keylist_start (ctx, keyid.c_str(), 0);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
@@ -1797,8 +4663,9 @@ FB::variant gpgAuthPluginAPI::gpgEnableKey(const std::string& keyid)
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    edit_status = "gpgEnableKey(keyid='" + keyid + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_enable, out, out);
+    state.op_id = edit_events.begin("gpgEnableKey(keyid='" + keyid + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
@@ -1825,8 +4692,11 @@ FB::variant gpgAuthPluginAPI::gpgDisableKey(const std::string& keyid)
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap response;
 
+    edit_add_command(state, "disable", "disable");
+
     err = gpgme_op_keylist_start (ctx, keyid.c_str(), 0);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
@@ -1843,8 +4713,9 @@ FB::variant gpgAuthPluginAPI::gpgDisableKey(const std::string& keyid)
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    edit_status = "gpgDisableKey(keyid='" + keyid + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_disable, out, out);
+    state.op_id = edit_events.begin("gpgDisableKey(keyid='" + keyid + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
@@ -1875,10 +4746,14 @@ FB::variant gpgAuthPluginAPI::gpgDeleteUIDSign(const std::string& keyid,
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap response;
 
-    current_uid = i_to_str(uid);
-    current_sig = i_to_str(signature);
+    std::string uid_arg = i_to_str(uid);
+    edit_command& command = edit_add_command(state, "delsig", "fpr",
+        uid_arg.c_str(), "delsig");
+    command.current_sig = i_to_str(signature);
+    command.signature_iter = 1;
 
     err = gpgme_op_keylist_start (ctx, keyid.c_str(), 0);
     if (err != GPG_ERR_NO_ERROR)
@@ -1896,14 +4771,13 @@ FB::variant gpgAuthPluginAPI::gpgDeleteUIDSign(const std::string& keyid,
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    edit_status = "gpgDeleteUIDSign(keyid='" + keyid + "', uid='" + i_to_str(uid) + "', signature='" + 
-        i_to_str(signature) + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_delsign, out, out);
+    state.op_id = edit_events.begin("gpgDeleteUIDSign(keyid='" + keyid + "', uid='" + i_to_str(uid) + "', signature='" + 
+        i_to_str(signature) + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    current_uid = "0";
-    current_sig = "0";
 
     gpgme_data_release (out);
     gpgme_key_unref (key);
@@ -2012,6 +4886,7 @@ std::string gpgAuthPluginAPI::gpgGenKeyWorker(const std::string& key_type, const
     gpgme_set_progress_cb (ctx, cb_status, APIObj);
 
     err = gpgme_op_genkey (ctx, parms, NULL, NULL);
+    keyring_changed();
     if (err)
         return "Error with genkey start" + err;
 
@@ -2082,14 +4957,16 @@ FB::variant gpgAuthPluginAPI::gpgGenSubKeyWorker(const std::string& keyid, const
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap response;
 
-    gen_subkey_type = subkey_type;
-    gen_subkey_length = subkey_length;
-    gen_subkey_expire = subkey_expire;
-    gen_sign_flag = sign_flag;
-    gen_enc_flag = enc_flag;
-    gen_auth_flag = auth_flag;
+    edit_command& command = edit_add_command(state, "addkey", "addkey");
+    command.gen_subkey_type = subkey_type;
+    command.gen_subkey_length = subkey_length;
+    command.expiration = subkey_expire;
+    command.gen_sign_flag = sign_flag;
+    command.gen_enc_flag = enc_flag;
+    command.gen_auth_flag = auth_flag;
 
     err = gpgme_op_keylist_start (ctx, keyid.c_str(), 0);
     if (err != GPG_ERR_NO_ERROR)
@@ -2109,11 +4986,12 @@ FB::variant gpgAuthPluginAPI::gpgGenSubKeyWorker(const std::string& keyid, const
 
     gpgme_set_progress_cb (ctx, cb_status, APIObj);
 
-    edit_status = "gpgGenSubKeyWorker(keyid='" + keyid + "', subkey_type='" + subkey_type + 
+    state.op_id = edit_events.begin("gpgGenSubKeyWorker(keyid='" + keyid + "', subkey_type='" + subkey_type + 
         "', subkey_length='" + subkey_length + "', subkey_expire='" + subkey_expire + "', sign_flag='" + 
         i_to_str(sign_flag) + "', enc_flag='" + i_to_str(enc_flag) + "', auth_flag='" + 
-        i_to_str(auth_flag) + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_add_subkey, out, out);
+        i_to_str(auth_flag) + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
 
     if (err != GPG_ERR_NO_ERROR) {
         if (gpg_err_code(err) == GPG_ERR_CANCELED)
@@ -2216,14 +5094,26 @@ std::string gpgAuthPluginAPI::gpgGenKey(const std::string& key_type,
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @fn FB::variant gpgAuthPluginAPI::gpgImportKey(const std::string& ascii_key)
+/// @fn FB::variant gpgAuthPluginAPI::gpgImportKey(const std::string& ascii_key, const boost::optional<FB::VariantMap>& options)
 ///
 /// @brief  Imports the ASCII encoded key ascii_key
 ///
 /// @param  ascii_key   An armored, ascii encoded PGP Key block.
+/// @param  options An optional object; "handle" names a handle to read the
+///                 key from.
 ///////////////////////////////////////////////////////////////////////////////
-FB::variant gpgAuthPluginAPI::gpgImportKey(const std::string& ascii_key)
+FB::variant gpgAuthPluginAPI::gpgImportKey(const std::string& ascii_key,
+    const boost::optional<FB::VariantMap>& options)
 {
+    boost::optional<FB::VariantMap> rest;
+    std::string handle = handle_option(options, "handle", rest);
+    if (handle.length()) {
+        boost::shared_ptr<std::string> ref = get_handle_data(handle);
+        if (!ref)
+            return get_error_map(__func__, -1, "Unknown handle", __LINE__, __FILE__, handle);
+        return gpgImportKey(*ref, rest);
+    }
+
     gpgme_ctx_t ctx = get_gpgme_ctx();
     gpgme_error_t err;
     gpgme_data_t key_buf;
@@ -2232,6 +5122,7 @@ FB::variant gpgAuthPluginAPI::gpgImportKey(const std::string& ascii_key)
     err = gpgme_data_new_from_mem (&key_buf, ascii_key.c_str(), ascii_key.length(), 1);
 
     err = gpgme_op_import (ctx, key_buf);
+    keyring_changed();
 
     result = gpgme_op_import_result (ctx);
     gpgme_data_release (key_buf);
@@ -2299,6 +5190,7 @@ FB::variant gpgAuthPluginAPI::gpgDeleteKey(const std::string& keyid, int allow_s
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
     err = gpgme_op_delete(ctx, key, allow_secret);
+    keyring_changed();
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
@@ -2353,9 +5245,11 @@ FB::variant gpgAuthPluginAPI::gpgDeletePrivateSubKey(const std::string& keyid, i
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap response;
 
-    key_index = i_to_str(key_idx);
+    std::string key_cmd = "key " + i_to_str(key_idx);
+    edit_add_command(state, "delkey", key_cmd.c_str(), "delkey");
 
     err = gpgme_op_keylist_start (ctx, keyid.c_str(), 0);
     if (err != GPG_ERR_NO_ERROR)
@@ -2373,21 +5267,19 @@ FB::variant gpgAuthPluginAPI::gpgDeletePrivateSubKey(const std::string& keyid, i
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    edit_status = "gpgDeletePrivateSubkey(keyid='" + keyid + "', key_idx='" + i_to_str(key_idx) +
-        "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_delete_subkey, out, out);
+    state.op_id = edit_events.begin("gpgDeletePrivateSubkey(keyid='" + keyid + "', key_idx='" + i_to_str(key_idx) +
+        "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-
-    key_index = "";
-
     gpgme_data_release (out);
     gpgme_key_unref (key);
     gpgme_release (ctx);
 
     response["error"] = false;
-    response["edit_status"] = edit_status;
+    response["edit_status"] = edit_events.transcript(state.op_id);
     response["result"] = "Subkey Delete";
 
     return response;
@@ -2446,8 +5338,10 @@ FB::variant gpgAuthPluginAPI::gpgSetKeyTrust(const std::string& keyid, long trus
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap response;
-    trust_assignment = i_to_str(trust_level);
+    edit_add_command(state, "trust", "trust").trust_assignment =
+        i_to_str(trust_level);
 
     if (trust_level < 1) {
         response["error"] = true;
@@ -2471,13 +5365,12 @@ FB::variant gpgAuthPluginAPI::gpgSetKeyTrust(const std::string& keyid, long trus
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    edit_status = "gpgSetKeyTrust(keyid='" + keyid + "', trust_level='" + i_to_str(trust_level) + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_assign_trust, out, out);
+    state.op_id = edit_events.begin("gpgSetKeyTrust(keyid='" + keyid + "', trust_level='" + i_to_str(trust_level) + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    trust_assignment = "0";
-
     gpgme_data_release (out);
     gpgme_key_unref (key);
     gpgme_release (ctx);
@@ -2488,6 +5381,166 @@ FB::variant gpgAuthPluginAPI::gpgSetKeyTrust(const std::string& keyid, long trus
     return response;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgImportOwnerTrust(const FB::VariantList& table)
+///
+/// @brief  Assigns the owner trust of many keys in a single gpg invocation
+///         (gpg --import-ownertrust) instead of one edit per key, and checks
+///         the trustdb once afterwards.
+///
+/// @param  table   A VariantList of objects with the "fpr" (fingerprint) of
+///                 a key and the "trust_level" to assign, 1 through 5 as for
+///                 gpgAuthPluginAPI::gpgSetKeyTrust(). gpg replaces the flag
+///                 bits along with the trust value, so the current flags of
+///                 each key are read first and kept; an optional boolean
+///                 "disabled" sets or clears the disabled flag instead.
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "count":400,
+    "error":false,
+    "result":"trust values assigned"
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgImportOwnerTrust(const FB::VariantList& table)
+{
+    FB::VariantMap response;
+    std::string ownertrust, output;
+    size_t i;
+    int status;
+
+    if (table.empty())
+        return get_error_map(__func__, -1, "No trust assignments specified", __LINE__, __FILE__);
+
+    // The flag bits (i.e. 0x80, disabled) currently set, by fingerprint
+    std::map<std::string, long> current_flags;
+    status = run_gpg("--export-ownertrust", "", output);
+    if (status != 0)
+        return get_error_map(__func__, -1, "gpg --export-ownertrust failed with status " + i_to_str(status), __LINE__, __FILE__);
+    {
+        std::istringstream lines(output);
+        std::string line;
+        while (std::getline(lines, line)) {
+            size_t colon = line.find(':');
+            if (line.empty() || line[0] == '#' || colon == std::string::npos)
+                continue;
+            current_flags[line.substr(0, colon)] =
+                strtol(line.c_str() + colon + 1, NULL, 10) & ~0x0fL;
+        }
+    }
+
+    for (i = 0; i < table.size(); i++) {
+        if (!table[i].is_of_type<FB::VariantMap>())
+            return get_error_map(__func__, -1, "Trust assignments must be objects", __LINE__, __FILE__);
+
+        FB::VariantMap entry = table[i].cast<FB::VariantMap>();
+        std::string fpr = map_string(entry, "fpr");
+        long trust_level = map_long(entry, "trust_level", 0);
+
+        for (size_t c = 0; c < fpr.length(); c++)
+            fpr[c] = toupper(fpr[c]);
+        if ((fpr.length() != 40 && fpr.length() != 32)
+            || fpr.find_first_not_of("0123456789ABCDEF") != std::string::npos)
+            return get_error_map(__func__, -1, "A full fingerprint is required: " + map_string(entry, "fpr"), __LINE__, __FILE__);
+        if (trust_level < 1 || trust_level > 5)
+            return get_error_map(__func__, -1, "Valid trust assignment values are 1 through 5", __LINE__, __FILE__);
+
+        long flags = current_flags.count(fpr) ? current_flags[fpr] : 0;
+        if (entry.find("disabled") != entry.end()) {
+            if (entry["disabled"].convert_cast<bool>())
+                flags |= 0x80;
+            else
+                flags &= ~0x80L;
+        }
+
+        // The ownertrust values of gpg are offset by one from the levels
+        //  of the trust menu of --edit-key
+        ownertrust += fpr + ":" + i_to_str(flags | (trust_level + 1)) + ":\n";
+    }
+
+    status = run_gpg("--import-ownertrust", ownertrust, output);
+    scrub_string(ownertrust);
+    if (status != 0)
+        return get_error_map(__func__, -1, "gpg --import-ownertrust failed with status " + i_to_str(status), __LINE__, __FILE__);
+
+    status = run_gpg("--check-trustdb", "", output);
+    if (status != 0)
+        return get_error_map(__func__, -1, "gpg --check-trustdb failed with status " + i_to_str(status), __LINE__, __FILE__);
+
+    response["error"] = false;
+    response["count"] = (long) table.size();
+    response["result"] = "trust values assigned";
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgExportOwnerTrust()
+///
+/// @brief  Reads the owner trust assigned to all keys in a single gpg
+///         invocation (gpg --export-ownertrust). "ownertrust" is the trust
+///         value of gpg and "disabled" is set for a key that is disabled.
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "error":false,
+    "ownertrust":[
+        {
+            "disabled":false,
+            "fpr":"0123456789ABCDEF0123456789ABCDEF01234567",
+            "ownertrust":5,
+            "trust_level":4
+        }, ...
+    ]
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgExportOwnerTrust()
+{
+    FB::VariantMap response;
+    FB::VariantList table;
+    std::string output;
+    std::istringstream lines;
+    std::string line;
+    int status;
+
+    status = run_gpg("--export-ownertrust", "", output);
+    if (status != 0)
+        return get_error_map(__func__, -1, "gpg --export-ownertrust failed with status " + i_to_str(status), __LINE__, __FILE__);
+
+    lines.str(output);
+    while (std::getline(lines, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        // FINGERPRINT:OWNERTRUST:
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        long value = strtol(line.c_str() + colon + 1, NULL, 10);
+        // The low 4 bits are the trust value, 0x80 flags a disabled key
+        long ownertrust = value & 0x0f;
+
+        FB::VariantMap entry;
+        entry["fpr"] = line.substr(0, colon);
+        entry["ownertrust"] = ownertrust;
+        entry["disabled"] = (value & 0x80) != 0;
+        entry["trust_level"] = (ownertrust >= 2 && ownertrust <= 6) ?
+            ownertrust - 1 : 0;
+        table.push_back(entry);
+    }
+
+    response["error"] = false;
+    response["ownertrust"] = table;
+
+    return response;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @fn FB::variant gpgAuthPluginAPI::gpgAddUID(const std::string& keyid, const std::string& name,
 ///     const std::string& email, const std::string& comment)
@@ -2506,10 +5559,12 @@ FB::variant gpgAuthPluginAPI::gpgAddUID(const std::string& keyid, const std::str
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap response;
-    genuid_name = name;
-    genuid_email = email;
-    genuid_comment = comment;
+    edit_command& command = edit_add_command(state, "adduid", "adduid");
+    command.genuid_name = name;
+    command.genuid_email = email;
+    command.genuid_comment = comment;
 
     if (isdigit(name.c_str()[0])) {
         response["error"] = true;
@@ -2539,26 +5594,24 @@ FB::variant gpgAuthPluginAPI::gpgAddUID(const std::string& keyid, const std::str
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    edit_status = "gpgAddUID(keyid='" + keyid + "', name='" + name + "', email='" + email + 
-        "', comment='" + comment + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_add_uid, out, out);
+    state.op_id = edit_events.begin("gpgAddUID(keyid='" + keyid + "', name='" + name + "', email='" + email + 
+        "', comment='" + comment + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    response["name"] = genuid_name;
-    response["email"] = genuid_email;
-    response["comment"] = genuid_comment;
+    response["name"] = name;
+    response["email"] = email;
+    response["comment"] = comment;
 
-    genuid_name = "";
-    genuid_email = "";
-    genuid_comment = "";
 
     gpgme_data_release (out);
     gpgme_key_unref (key);
     gpgme_release (ctx);
 
     response["error"] = false;
-    response["edit_status"] = edit_status;
+    response["edit_status"] = edit_events.transcript(state.op_id);
     response["result"] = "UID added";
 
     return response;
@@ -2578,6 +5631,7 @@ FB::variant gpgAuthPluginAPI::gpgDeleteUID(const std::string& keyid, long uid_id
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap response;
 
     if (uid_idx < 1) {
@@ -2586,7 +5640,8 @@ FB::variant gpgAuthPluginAPI::gpgDeleteUID(const std::string& keyid, long uid_id
         return response;
     }
 
-    current_uid = i_to_str(uid_idx);
+    std::string uid = i_to_str(uid_idx);
+    edit_add_command(state, "deluid", uid.c_str(), "deluid");
 
     err = gpgme_op_keylist_start (ctx, keyid.c_str(), 0);
     if (err != GPG_ERR_NO_ERROR)
@@ -2604,20 +5659,18 @@ FB::variant gpgAuthPluginAPI::gpgDeleteUID(const std::string& keyid, long uid_id
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    edit_status = "gpgDeleteUID(keyid='" + keyid + "', uid_idx='" + i_to_str(uid_idx) + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_delete_uid, out, out);
+    state.op_id = edit_events.begin("gpgDeleteUID(keyid='" + keyid + "', uid_idx='" + i_to_str(uid_idx) + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-
-    current_uid = "0";
-
     gpgme_data_release (out);
     gpgme_key_unref (key);
     gpgme_release (ctx);
 
     response["error"] = false;
-    response["edit_status"] = edit_status;
+    response["edit_status"] = edit_events.transcript(state.op_id);
     response["result"] = "UID deleted";
 
     return response;
@@ -2637,6 +5690,7 @@ FB::variant gpgAuthPluginAPI::gpgSetPrimaryUID(const std::string& keyid, long ui
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap response;
 
     if (uid_idx < 1) {
@@ -2645,7 +5699,8 @@ FB::variant gpgAuthPluginAPI::gpgSetPrimaryUID(const std::string& keyid, long ui
         return response;
     }
 
-    current_uid = i_to_str(uid_idx);
+    std::string uid = i_to_str(uid_idx);
+    edit_add_command(state, "primary", uid.c_str(), "primary");
 
     err = gpgme_op_keylist_start (ctx, keyid.c_str(), 0);
     if (err != GPG_ERR_NO_ERROR)
@@ -2663,20 +5718,18 @@ FB::variant gpgAuthPluginAPI::gpgSetPrimaryUID(const std::string& keyid, long ui
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    edit_status = "gpgSetPrimaryUID(keyid='" + keyid + "', uid_idx='" + i_to_str(uid_idx) + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_set_primary_uid, out, out);
+    state.op_id = edit_events.begin("gpgSetPrimaryUID(keyid='" + keyid + "', uid_idx='" + i_to_str(uid_idx) + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-
-    current_uid = "0";
-
     gpgme_data_release (out);
     gpgme_key_unref (key);
     gpgme_release (ctx);
 
     response["error"] = false;
-    response["edit_status"] = edit_status;
+    response["edit_status"] = edit_events.transcript(state.op_id);
     response["result"] = "Primary UID changed";
 
     return response;
@@ -2697,10 +5750,12 @@ FB::variant gpgAuthPluginAPI::gpgSetKeyExpire(const std::string& keyid, long key
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap response;
 
-    key_index = i_to_str(key_idx);
-    expiration = i_to_str(expire);
+    std::string key_cmd = "key " + i_to_str(key_idx);
+    edit_add_command(state, "expire", key_cmd.c_str(), "expire").expiration =
+        i_to_str(expire);
 
     err = gpgme_op_keylist_start (ctx, keyid.c_str(), 0);
     if (err != GPG_ERR_NO_ERROR)
@@ -2718,22 +5773,20 @@ FB::variant gpgAuthPluginAPI::gpgSetKeyExpire(const std::string& keyid, long key
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    edit_status = "gpgSetKeyExpire(keyid='" + keyid + "', key_idx='" + i_to_str(key_idx) + 
-        "', expire='" + i_to_str(expire) + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_set_key_expire, out, out);
+    state.op_id = edit_events.begin("gpgSetKeyExpire(keyid='" + keyid + "', key_idx='" + i_to_str(key_idx) + 
+        "', expire='" + i_to_str(expire) + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
 
-    key_index = "";
-    expiration = "";
-
     gpgme_data_release (out);
     gpgme_key_unref (key);
     gpgme_release (ctx);
 
     response["error"] = false;
-    response["edit_status"] = edit_status;
+    response["edit_status"] = edit_events.transcript(state.op_id);
     response["result"] = "Expiration changed";
 
     return response;
@@ -2767,11 +5820,13 @@ FB::variant gpgAuthPluginAPI::gpgSetSubkeyExpire(const std::string& keyid, long
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @fn FB::variant gpgAuthPluginAPI::gpgExportPublicKey(const std::string& keyid)
+/// @fn FB::variant gpgAuthPluginAPI::gpgExportPublicKey(const std::string& keyid, const boost::optional<FB::VariantMap>& options)
 ///
 /// @brief  Exports the public key specified with keyid as an armored ASCII encoded PGP Block.
 ///
 /// @param  keyid   The ID of the Public key to export.
+/// @param  options An optional object; "return_handle" returns the key
+///                 as a handle (see gpgAuthPluginAPI::createHandle()).
 ///
 /// @returns FB::variant response
 /*! @verbatim
@@ -2789,7 +5844,8 @@ response {
 @endverbatim
 */
 ///////////////////////////////////////////////////////////////////////////////
-FB::variant gpgAuthPluginAPI::gpgExportPublicKey(const std::string& keyid)
+FB::variant gpgAuthPluginAPI::gpgExportPublicKey(const std::string& keyid,
+    const boost::optional<FB::VariantMap>& options)
 {
     gpgme_ctx_t ctx = get_gpgme_ctx();
     gpgme_error_t err;
@@ -2809,9 +5865,12 @@ FB::variant gpgAuthPluginAPI::gpgExportPublicKey(const std::string& keyid)
 
     size_t out_size = 0;
     std::string out_buf;
-    out_buf = gpgme_data_release_and_get_mem (out, &out_size);
-    /* strip the size_t data out of the output buffer */
-    out_buf = out_buf.substr(0, out_size);
+    char *out_mem = gpgme_data_release_and_get_mem (out, &out_size);
+    /* copy out_size bytes, the output may be binary and contain NULs */
+    if (out_mem) {
+        out_buf.assign(out_mem, out_size);
+        gpgme_free (out_mem);
+    }
     /* set the output object to NULL since it has
         already been released */
     out = NULL;
@@ -2821,7 +5880,7 @@ FB::variant gpgAuthPluginAPI::gpgExportPublicKey(const std::string& keyid)
     response["error"] = false;
     response["result"] = out_buf;
 
-    return response;
+    return handle_response(response, options, "result");
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -2846,15 +5905,21 @@ FB::variant gpgAuthPluginAPI::gpgRevokeItem(const std::string& keyid, const std:
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap response;
 
-    key_index = i_to_str(key_idx);
-    current_uid = i_to_str(uid_idx);
-    current_sig = i_to_str(sig_idx);
-    revitem = item.c_str();
-    reason_index = i_to_str(reason);
-    description = desc.c_str();
+    std::string cmd;
 
+    if (item == "revkey")
+        cmd = "key " + i_to_str(key_idx);
+    else if (item == "revuid" || item == "revsig")
+        cmd = "uid " + i_to_str(uid_idx);
+
+    edit_command& command = edit_add_command(state, item, cmd.c_str(),
+        item.c_str());
+    command.current_sig = i_to_str(sig_idx);
+    command.reason_index = i_to_str(reason);
+    command.description = desc;
 
     err = gpgme_op_keylist_start (ctx, keyid.c_str(), 0);
     if (err != GPG_ERR_NO_ERROR)
@@ -2872,24 +5937,21 @@ FB::variant gpgAuthPluginAPI::gpgRevokeItem(const std::string& keyid, const std:
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    edit_status = "gpgRevokeItem(keyid='" + keyid + "', item='" + item + "', key_idx='" + 
+    state.op_id = edit_events.begin("gpgRevokeItem(keyid='" + keyid + "', item='" + item + "', key_idx='" + 
         i_to_str(key_idx) + "', uid_idx='" + i_to_str(uid_idx) + "', sig_idx='" + i_to_str(sig_idx) +
-        "', reason='" + i_to_str(reason) + "', desc='" + desc + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_revoke_item, out, out);
+        "', reason='" + i_to_str(reason) + "', desc='" + desc + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
     if (err != GPG_ERR_NO_ERROR)
         return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
 
-    key_index = "";
-    reason_index = "";
-    current_uid = "";
-
     gpgme_data_release (out);
     gpgme_key_unref (key);
     gpgme_release (ctx);
 
     response["error"] = false;
-    response["edit_status"] = edit_status;
+    response["edit_status"] = edit_events.transcript(state.op_id);
     response["result"] = "Item Revoked";
 
     return response;
@@ -2947,6 +6009,182 @@ FB::variant gpgAuthPluginAPI::gpgRevokeSignature(const std::string& keyid, int u
     return gpgAuthPluginAPI::gpgRevokeItem(keyid, "revsig", 0, uid_idx, sig_idx, reason, desc);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::gpgEditKeyBatch(const std::string& keyid, const FB::VariantList& commands)
+///
+/// @brief  Applies a sequence of edits to the key specified with keyid in a
+///         single gpg edit session, which saves the key (and updates the
+///         trustdb) once at the end instead of once per edit. UID and subkey
+///         indexes refer to the key as it is when that command runs, so an
+///         earlier deluid or delkey shifts the indexes of later commands (and
+///         an earlier adduid adds one). Every index is checked against the
+///         key before the edit starts; if any is out of range nothing is
+///         changed.
+///
+/// @param  keyid   The ID of the key to edit.
+/// @param  commands    An array of command objects, each with a "command"
+///                     member and the arguments of that command:
+///                     - "trust" with "trust_level" (1-5)
+///                     - "adduid" with "name", "email" and "comment"
+///                     - "deluid" with "uid_idx"
+///                     - "primary" with "uid_idx"
+///                     - "expire" with "key_idx" and "expire" (as for
+///                       gpgAuthPluginAPI::gpgSetKeyExpire())
+///                     - "delkey" with "key_idx"
+///                     - "enable" or "disable"
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "count":3,
+    "edit_status":"gpgEditKeyBatch(keyid='...', commands='trust,adduid,expire');\n ...",
+    "error":false,
+    "result":"key edited"
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::gpgEditKeyBatch(const std::string& keyid,
+    const FB::VariantList& commands)
+{
+    gpgme_ctx_t ctx;
+    gpgme_error_t err;
+    gpgme_data_t out = NULL;
+    gpgme_key_t key = NULL;
+    edit_state state;
+    FB::VariantMap response;
+    std::string command_names;
+    // The UID or subkey index given to each command, or -1
+    std::vector<long> indexes;
+    size_t i;
+
+    if (commands.empty())
+        return get_error_map(__func__, -1, "No commands specified", __LINE__, __FILE__);
+
+    for (i = 0; i < commands.size(); i++) {
+        if (!commands[i].is_of_type<FB::VariantMap>())
+            return get_error_map(__func__, -1, "Commands must be objects", __LINE__, __FILE__);
+
+        FB::VariantMap command_map = commands[i].cast<FB::VariantMap>();
+        edit_command command;
+        command.name = map_string(command_map, "command");
+        indexes.push_back(-1);
+
+        if (command.name == "trust") {
+            long trust_level = map_long(command_map, "trust_level", 0);
+            if (trust_level < 1 || trust_level > 5)
+                return get_error_map(__func__, -1, "Valid trust assignment values are 1 through 5", __LINE__, __FILE__);
+            command.trust_assignment = i_to_str(trust_level);
+            command.prompts.push_back("trust");
+        } else if (command.name == "adduid") {
+            command.genuid_name = map_string(command_map, "name");
+            command.genuid_email = map_string(command_map, "email");
+            command.genuid_comment = map_string(command_map, "comment");
+            if (isdigit((unsigned char) command.genuid_name.c_str()[0]))
+                return get_error_map(__func__, -1, "UID names cannot start with a digit...", __LINE__, __FILE__);
+            if (command.genuid_name.length() < 5)
+                return get_error_map(__func__, -1, "UID's must be at least 5 chars long...", __LINE__, __FILE__);
+            command.prompts.push_back("adduid");
+        } else if (command.name == "deluid" || command.name == "primary") {
+            long uid_idx = map_long(command_map, "uid_idx", -1);
+            if (uid_idx < 1)
+                return get_error_map(__func__, -1, "A valid uid_idx is required for " + command.name, __LINE__, __FILE__);
+            indexes.back() = uid_idx;
+            command.prompts.push_back("uid " + i_to_str(uid_idx));
+            command.prompts.push_back(command.name);
+            command.prompts.push_back("uid 0");
+        } else if (command.name == "expire" || command.name == "delkey") {
+            long key_idx = map_long(command_map, "key_idx", -1);
+            if (key_idx < 0 || (command.name == "delkey" && key_idx < 1))
+                return get_error_map(__func__, -1, "A valid key_idx is required for " + command.name, __LINE__, __FILE__);
+            indexes.back() = key_idx;
+            command.expiration = i_to_str(map_long(command_map, "expire", 0));
+            command.prompts.push_back("key " + i_to_str(key_idx));
+            command.prompts.push_back(command.name);
+            command.prompts.push_back("key 0");
+        } else if (command.name == "enable" || command.name == "disable") {
+            command.prompts.push_back(command.name);
+        } else {
+            return get_error_map(__func__, -1, "Unknown command: " + command.name, __LINE__, __FILE__);
+        }
+
+        command_names += (i ? "," : "") + command.name;
+        state.commands.push_back(command);
+    }
+
+    ctx = get_gpgme_ctx();
+
+    err = gpgme_op_keylist_start (ctx, keyid.c_str(), 0);
+    if (err != GPG_ERR_NO_ERROR)
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+
+    err = gpgme_op_keylist_next (ctx, &key);
+    if (err != GPG_ERR_NO_ERROR)
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+
+    err = gpgme_op_keylist_end (ctx);
+    if (err != GPG_ERR_NO_ERROR)
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+
+    // gpg ignores a "uid" or "key" selection that is out of range, which
+    //  would apply the command to the wrong UID or to the primary key; check
+    //  the indexes against the key, following the changes made by the
+    //  earlier commands
+    long nuids = 0, nsubkeys = -1;
+    for (gpgme_user_id_t uid = key->uids; uid; uid = uid->next)
+        nuids++;
+    for (gpgme_subkey_t subkey = key->subkeys; subkey; subkey = subkey->next)
+        nsubkeys++;
+
+    for (i = 0; i < state.commands.size(); i++) {
+        const std::string& name = state.commands[i].name;
+        std::string error;
+
+        if ((name == "deluid" || name == "primary") && indexes[i] > nuids)
+            error = "The key has no uid_idx " + i_to_str(indexes[i]);
+        else if (name == "deluid" && nuids == 1)
+            error = "The last UID of a key cannot be deleted";
+        else if ((name == "expire" || name == "delkey") && indexes[i] > nsubkeys)
+            error = "The key has no subkey with key_idx " + i_to_str(indexes[i]);
+
+        if (error.length()) {
+            gpgme_key_unref (key);
+            gpgme_release (ctx);
+            return get_error_map(__func__, -1, error + " at command " + i_to_str(i) + " (" + name + ")",
+                __LINE__, __FILE__);
+        }
+
+        if (name == "adduid")
+            nuids++;
+        else if (name == "deluid")
+            nuids--;
+        else if (name == "delkey")
+            nsubkeys--;
+    }
+
+    err = gpgme_data_new (&out);
+    if (err != GPG_ERR_NO_ERROR)
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+
+    state.op_id = edit_events.begin("gpgEditKeyBatch(keyid='" + keyid + "', commands='" + command_names + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
+
+    gpgme_data_release (out);
+    gpgme_key_unref (key);
+    gpgme_release (ctx);
+
+    if (err != GPG_ERR_NO_ERROR)
+        return get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
+
+    response["error"] = false;
+    response["count"] = (long) state.commands.size();
+    response["edit_status"] = edit_events.transcript(state.op_id);
+    response["result"] = "key edited";
+
+    return response;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @fn FB::variant gpgAuthPluginAPI::gpgChangePassphrase(const std::string& keyid)
 ///
@@ -2960,8 +6198,11 @@ FB::variant gpgAuthPluginAPI::gpgChangePassphrase(const std::string& keyid)
     gpgme_error_t err;
     gpgme_data_t out = NULL;
     gpgme_key_t key = NULL;
+    edit_state state;
     FB::VariantMap result;
 
+    edit_add_command(state, "passwd", "passwd");
+
     err = gpgme_op_keylist_start (ctx, keyid.c_str(), 0);
     if (err != GPG_ERR_NO_ERROR)
         result = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
@@ -2978,8 +6219,9 @@ FB::variant gpgAuthPluginAPI::gpgChangePassphrase(const std::string& keyid)
     if (err != GPG_ERR_NO_ERROR)
         result = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
-    edit_status = "gpgChangePassphrase(keyid='" + keyid + "');\n";
-    err = gpgme_op_edit (ctx, key, edit_fnc_change_passphrase, out, out);
+    state.op_id = edit_events.begin("gpgChangePassphrase(keyid='" + keyid + "');");
+    err = gpgme_op_edit (ctx, key, edit_fnc, &state, out);
+    edit_events.finish(state.op_id, err);
     if (err != GPG_ERR_NO_ERROR)
         result = get_error_map(__func__, gpgme_err_code (err), gpgme_strerror (err), __LINE__, __FILE__);
 
@@ -3046,150 +6288,295 @@ int gpgAuthPluginAPI::verifyDomainKey(const std::string& domain,
         const std::string& domain_key_fpr, long uid_idx,
         const std::string& required_sig_keyid)
 {
-    int nuids;
-    int nsigs;
-    int domain_key_valid = -1;
-    gpgme_ctx_t ctx = get_gpgme_ctx();
-    gpgme_key_t domain_key, user_key, secret_key, key;
-    gpgme_user_id_t uid;
-    gpgme_key_sig_t sig;
-    gpgme_error_t err;
-    gpgme_keylist_result_t result;
-    
-    gpgme_set_keylist_mode (ctx, (gpgme_get_keylist_mode (ctx) 
-                                | GPGME_KEYLIST_MODE_SIGS));
-
-    err = gpgme_op_keylist_start (ctx, (char *) domain_key_fpr.c_str(), 0);
-    if(err != GPG_ERR_NO_ERROR) return -1;
-
-    err = gpgme_get_key(ctx, (char *) required_sig_keyid.c_str(), &user_key, 0);
-    if(err != GPG_ERR_NO_ERROR) return -1;
-
-    if (user_key) {
-        while (!(err = gpgme_op_keylist_next (ctx, &domain_key))) {
-            for (nuids=0, uid=domain_key->uids; uid; uid = uid->next, nuids++) {
-                for (nsigs=0, sig=uid->signatures; sig; sig = sig->next, nsigs++) {
-                    if (domain_key->disabled) {
-                        domain_key_valid = -2;
-                        break;
-                    }
-                    if (!strcmp(uid->name, (char *) domain.c_str()) && (uid_idx == nuids || uid_idx == -1)) {
-                        if (uid->revoked)
-                            domain_key_valid = -3;
-                        if (!strcmp(sig->keyid, (char *) required_sig_keyid.c_str())){
-                            if (user_key->owner_trust == GPGME_VALIDITY_ULTIMATE)
-                                domain_key_valid = 0;
-                            if (user_key->owner_trust == GPGME_VALIDITY_FULL)
-                                domain_key_valid = 2;
-                            if (user_key->expired)
-                                domain_key_valid++;
-                            if (sig->invalid)
-                                domain_key_valid = -4;
-                            if (sig->revoked)
-                                domain_key_valid = -4;
-                            if (sig->expired)
-                                domain_key_valid = -4;
-                            if (user_key->disabled)
-                                domain_key_valid = -5;
-                            if (sig->status == GPG_ERR_NO_PUBKEY)
-                                domain_key_valid = -1;
-                            if (sig->status == GPG_ERR_GENERAL)
-                                domain_key_valid = -1;
-                            // the key trust is 0 (best), stop searching
-                            if (domain_key_valid == 0)
-                                break;
-                        }
-                    }
-                }
+    return evaluateDomainKey(get_trust_graph(), domain, domain_key_fpr,
+        uid_idx, required_sig_keyid);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::verifyDomainKeyBatch(const std::string& domain, const std::string& domain_key_fpr, long uid_idx, const FB::VariantList& required_sig_keyids)
+///
+/// @brief  Performs gpgAuthPluginAPI::verifyDomainKey() for each of the key
+///         ids in required_sig_keyids against a single snapshot of the
+///         keyring, so that a login only needs one pass over the trusted
+///         keys. The best result is the lowest non-negative value if there
+///         is one, otherwise the highest negative value.
+///
+/// @param  domain  The UID of the domain key to check.
+/// @param  domain_key_fpr  The fingerprint (or ID) of the domain key.
+/// @param  uid_idx The index of the UID to check, or -1 for any UID.
+/// @param  required_sig_keyids The IDs of the trusted keys to evaluate.
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "error":false,
+    "result":0,
+    "signer":"0DF9C95C3BE1A023",
+    "signers":{
+        "0DF9C95C3BE1A023":{
+            "expired":false,
+            "owner_trust":"ultimate",
+            "result":0,
+            "secret":true
+        },
+        "5EBB2B7F1E7194EC":{
+            "result":-1
+        }
+    }
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::verifyDomainKeyBatch(const std::string& domain,
+        const std::string& domain_key_fpr, long uid_idx,
+        const FB::VariantList& required_sig_keyids)
+{
+    FB::VariantMap response;
+    FB::VariantMap signers_map;
+    trustGraphPtr graph = get_trust_graph();
+    std::string best_signer;
+    int best = -1;
+    bool have_best = false;
+    size_t i;
+
+    for (i = 0; i < required_sig_keyids.size(); i++) {
+        std::string keyid = required_sig_keyids[i].convert_cast<std::string>();
+        FB::VariantMap signer_map;
+        int result = evaluateDomainKey(graph, domain, domain_key_fpr, uid_idx,
+            keyid);
+
+        signer_map["result"] = result;
+        if (graph) {
+            long key_idx = trust_graph_find(*graph, keyid);
+            if (key_idx >= 0) {
+                const trust_key& key = graph->keys[key_idx];
+                signer_map["owner_trust"] = key.owner_trust == GPGME_VALIDITY_UNKNOWN? "unknown":
+                    key.owner_trust == GPGME_VALIDITY_UNDEFINED? "undefined":
+                    key.owner_trust == GPGME_VALIDITY_NEVER? "never":
+                    key.owner_trust == GPGME_VALIDITY_MARGINAL? "marginal":
+                    key.owner_trust == GPGME_VALIDITY_FULL? "full":
+                    key.owner_trust == GPGME_VALIDITY_ULTIMATE? "ultimate": "[?]";
+                signer_map["expired"] = key.expired;
+                signer_map["secret"] = key.secret;
             }
         }
+        signers_map[keyid] = signer_map;
+
+        // Any non-negative result beats every negative one; among the
+        //  negative results -1 (not signed) is the least severe
+        if (!have_best
+            || (result >= 0 && (best < 0 || result < best))
+            || (result < 0 && best < 0 && result > best)) {
+            best = result;
+            best_signer = keyid;
+            have_best = true;
+        }
+    }
 
-        if (gpg_err_code (err) != GPG_ERR_EOF) return -1;
-        gpgme_get_key(ctx, (char *) domain_key_fpr.c_str(), &domain_key, 0);
-        err = gpgme_op_keylist_end (ctx);
-        if(err != GPG_ERR_NO_ERROR) return -1;
-
-        result = gpgme_op_keylist_result (ctx);
-        // the UID failed the signature test, check to see if the primary UID was signed
-        // by one permissible key, or a trusted key.
-        if (domain_key_valid == -1) {
-            for (nuids=0, uid=domain_key->uids; uid; uid = uid->next, nuids++) {
-                for (nsigs=0, sig=uid->signatures; sig; sig=sig->next, nsigs++) {
-                    if (!sig->status == GPG_ERR_NO_ERROR)
-                        continue;
-                    // the signature keyid matches the required_sig_keyid
-                    if (nuids == uid_idx && domain_key_valid == -1){
-                        err = gpgme_get_key(ctx, (char *) sig->keyid, &key, 0);
-                        if(err != GPG_ERR_NO_ERROR) return -1;
-                        err = gpgme_get_key(ctx, (char *) sig->keyid, &secret_key, 1);
-                        if(err != GPG_ERR_NO_ERROR) return -1;
-
-                        if (key && key->owner_trust == GPGME_VALIDITY_ULTIMATE) {
-                            if (!secret_key) {
-                                domain_key_valid = 8;
-                            } else {
-                                domain_key_valid = 4;
-                            }
-                        }
-                        if (key && key->owner_trust == GPGME_VALIDITY_FULL) {
-                            if (!secret_key) {
-                                domain_key_valid = 8;
-                            } else {
-                                domain_key_valid = 6;
-                            }
-                        }
-                        if (key && key->expired && domain_key_valid < -1)
-                            domain_key_valid += -1;
-                        if (key && key->expired && domain_key_valid >= 0) {
-                            domain_key_valid++;
-                        }
-                        if (sig->expired)
-                            domain_key_valid = -6;
-                        if (sig->invalid)
-                            domain_key_valid = -2;
-                        if (uid->revoked || sig->revoked)
-                            domain_key_valid = -6;
-                        if (sig->status == GPG_ERR_NO_PUBKEY)
-                            domain_key_valid = -1;
-                        if (sig->status == GPG_ERR_GENERAL)
-                            domain_key_valid = -1;
-                        if (key)
-                            gpgme_key_unref (key);
-                        if (secret_key)
-                            gpgme_key_unref (secret_key);
-                    }
-                    if (!strcmp(sig->keyid, (char *) required_sig_keyid.c_str())){
-                        if (nuids == 0) {
-                            if (user_key && user_key->owner_trust == GPGME_VALIDITY_ULTIMATE)
-                                domain_key_valid = 4;
-                            if (user_key && user_key->owner_trust == GPGME_VALIDITY_FULL)
-                                domain_key_valid = 6;
-                            if (user_key && user_key->expired)
-                                domain_key_valid++;
-                            if (sig->expired)
-                                domain_key_valid = -6;
-                            if (sig->invalid)
-                                domain_key_valid = -2;
-                            if (uid->revoked || sig->revoked)
-                                domain_key_valid = -6;
-                            if (sig->status == GPG_ERR_NO_PUBKEY)
-                                domain_key_valid = -1;
-                            if (sig->status == GPG_ERR_GENERAL)
-                                domain_key_valid = -1;
-                        }
-                    }
-                }
-            }
+    response["result"] = best;
+    if (have_best)
+        response["signer"] = best_signer;
+    response["signers"] = signers_map;
+    response["error"] = false;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn FB::variant gpgAuthPluginAPI::findTrustPath(const std::string& target_fpr, long max_depth, const boost::optional<FB::VariantMap>& options)
+///
+/// @brief  Computes the validity the PGP trust model of gpg gives the key
+///         target_fpr and finds the shortest chain of certifications that
+///         connects one of the ultimately trusted keys to it. As in gpg,
+///         only keys that are fully valid themselves and have full or
+///         marginal ownertrust act as introducers, so every key of the chain
+///         but the target is fully valid; a "marginal" target is certified by
+///         introducers, but by fewer than are needed to make it fully valid.
+///
+/// @param  target_fpr  The fingerprint (or ID) of the key to find a path to.
+/// @param  max_depth   The maximum number of certifications in the chain; 0
+///                     uses the gpg default of 5.
+/// @param  options An optional object; "completes_needed" and
+///                 "marginals_needed" should be given if gpg is not using
+///                 its defaults of 1 and 3.
+///
+/// @returns FB::variant response
+/*! @verbatim
+response {
+    "depth":2,
+    "error":false,
+    "found":true,
+    "path":[
+        {
+            "fpr":"1A2B3C...",
+            "keyid":"0DF9C95C3BE1A023",
+            "name":"Kyle L. Huff",
+            "owner_trust":"ultimate"
+        },
+        {
+            "fpr":"4D5E6F...",
+            "keyid":"5EBB2B7F1E7194EC",
+            "name":"Introducer",
+            "owner_trust":"full"
+        },
+        {
+            "fpr":"7A8B9C...",
+            "keyid":"2E1B5A4C1F91E2F0",
+            "name":"gpgauth.org",
+            "owner_trust":"unknown"
         }
+    ],
+    "validity":"full"
+}
+@endverbatim
+*/
+///////////////////////////////////////////////////////////////////////////////
+FB::variant gpgAuthPluginAPI::findTrustPath(const std::string& target_fpr,
+        long max_depth, const boost::optional<FB::VariantMap>& options)
+{
+    FB::VariantMap response;
+    FB::VariantList path_list;
+    std::vector<long> path;
+    std::vector<gpgme_validity_t> computed;
+    std::string validity = "unknown";
+    long completes_needed = options ? map_long(*options, "completes_needed", 1) : 1;
+    long marginals_needed = options ? map_long(*options, "marginals_needed", 3) : 3;
+    trustGraphPtr graph = get_trust_graph();
+    size_t i;
+
+    if (!graph)
+        return get_error_map(__func__, -1, "Unable to list the keyring", __LINE__, __FILE__);
+
+    long target_idx = trust_graph_find(*graph, target_fpr);
+    if (target_idx < 0)
+        return get_error_map(__func__, -1, "Unknown or ambiguous key", __LINE__, __FILE__, target_fpr);
+
+    if (max_depth <= 0)
+        max_depth = 5;
+
+    if (completes_needed < 1 || marginals_needed < 1)
+        return get_error_map(__func__, -1, "completes_needed and marginals_needed must be at least 1",
+            __LINE__, __FILE__);
+
+    // The validity of every key only changes with the graph; compute it once
+    //  per graph and trust model
+    std::string memo_key = i_to_str(completes_needed) + ":"
+        + i_to_str(marginals_needed) + ":" + i_to_str(max_depth);
+    const std::vector<gpgme_validity_t>* memo = NULL;
+    {
+        boost::mutex::scoped_lock lock(trust_graph_mutex);
+        std::map<std::string, std::vector<gpgme_validity_t> >::const_iterator it =
+            graph->validity_memo.find(memo_key);
+        if (it != graph->validity_memo.end())
+            memo = &it->second;
     }
+    if (!memo) {
+        trust_graph_validity(*graph, completes_needed, marginals_needed, max_depth,
+            computed);
+        boost::mutex::scoped_lock lock(trust_graph_mutex);
+        // Bound the number of trust models remembered per graph; an entry
+        //  stored meanwhile by another call is kept as is
+        if (graph->validity_memo.size() < 8 || graph->validity_memo.count(memo_key))
+            memo = &graph->validity_memo.insert(std::make_pair(memo_key, computed)).first->second;
+    }
+    const std::vector<gpgme_validity_t>& key_validity = memo ? *memo : computed;
 
-    if (domain_key)
-        gpgme_key_unref (domain_key);
-    if (user_key)
-        gpgme_key_unref (user_key);
+    if (trust_graph_find_path(*graph, target_idx, max_depth, key_validity, path))
+        validity = key_validity[target_idx] == GPGME_VALIDITY_ULTIMATE? "ultimate":
+            key_validity[target_idx] == GPGME_VALIDITY_FULL? "full":
+            key_validity[target_idx] == GPGME_VALIDITY_MARGINAL? "marginal": "unknown";
 
-    if (ctx)
-        gpgme_release (ctx);
+    const trust_key& target = graph->keys[target_idx];
+    if (path.size() && (target.revoked || target.disabled || target.invalid))
+        validity = "invalid";
+    else if (path.size() && target.expired)
+        validity = "expired";
+
+    for (i = 0; i < path.size(); i++) {
+        const trust_key& key = graph->keys[path[i]];
+        FB::VariantMap key_map;
+        key_map["fpr"] = key.fpr;
+        key_map["keyid"] = key.keyid;
+        key_map["name"] = key.uids.size() ? key.uids[0].name : "";
+        key_map["owner_trust"] = key.owner_trust == GPGME_VALIDITY_UNKNOWN? "unknown":
+            key.owner_trust == GPGME_VALIDITY_UNDEFINED? "undefined":
+            key.owner_trust == GPGME_VALIDITY_NEVER? "never":
+            key.owner_trust == GPGME_VALIDITY_MARGINAL? "marginal":
+            key.owner_trust == GPGME_VALIDITY_FULL? "full":
+            key.owner_trust == GPGME_VALIDITY_ULTIMATE? "ultimate": "[?]";
+        path_list.push_back(key_map);
+    }
+
+    response["found"] = path.size() > 0;
+    response["depth"] = path.size() ? (long) path.size() - 1 : -1;
+    response["path"] = path_list;
+    response["validity"] = validity;
+    response["error"] = false;
+
+    return response;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn int gpgAuthPluginAPI::evaluateDomainKey(trustGraphPtr graph, const std::string& domain, const std::string& domain_key_fpr, long uid_idx, const std::string& required_sig_keyid)
+///
+/// @brief  Evaluates verifyDomainKey() against graph, falling back to
+///         gpgAuthPluginAPI::verifyDomainKeyDirect() when graph is empty or
+///         cannot resolve the key ids given.
+///
+///         Results are memoized for the lifetime of graph, which ends when
+///         the keyring or trustdb changes or a key or signature in the
+///         keyring expires.
+///////////////////////////////////////////////////////////////////////////////
+int gpgAuthPluginAPI::evaluateDomainKey(trustGraphPtr graph,
+        const std::string& domain, const std::string& domain_key_fpr,
+        long uid_idx, const std::string& required_sig_keyid)
+{
+    int result;
+    bool memoized;
+
+    if (!graph)
+        return verifyDomainKeyDirect(domain, domain_key_fpr, uid_idx,
+            required_sig_keyid);
+
+    std::string memo_key = domain + "\n" + domain_key_fpr + "\n"
+        + i_to_str(uid_idx) + "\n" + required_sig_keyid;
+    std::string memo_stamp = i_to_str(graph->generation);
+
+    {
+        boost::mutex::scoped_lock lock(domain_key_memo_mutex);
+        memoized = domain_key_memo.get(memo_key, memo_stamp, result);
+    }
+
+    if (!memoized) {
+        // Patterns the graph cannot resolve are left to gpg
+        if (!trust_graph_evaluate_domain_key(*graph, domain, domain_key_fpr,
+            uid_idx, required_sig_keyid, result))
+            result = verifyDomainKeyDirect(domain, domain_key_fpr, uid_idx,
+                required_sig_keyid);
+
+        boost::mutex::scoped_lock lock(domain_key_memo_mutex);
+        domain_key_memo.put(memo_key, memo_stamp, graph->expires, result);
+    }
+
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn int gpgAuthPluginAPI::verifyDomainKeyDirect(const std::string& domain, const std::string& domain_key_fpr, long uid_idx, const std::string& required_sig_keyid)
+///
+/// @brief  Evaluates verifyDomainKey() by querying gpg for each of the keys
+///         involved; used when the signature graph is not available or
+///         cannot resolve the key ids given.
+///////////////////////////////////////////////////////////////////////////////
+int gpgAuthPluginAPI::verifyDomainKeyDirect(const std::string& domain,
+        const std::string& domain_key_fpr, long uid_idx,
+        const std::string& required_sig_keyid)
+{
+    gpgme_ctx_t ctx = get_gpgme_ctx();
+    int domain_key_valid = trust_graph_domain_key_validity_gpg(ctx, domain,
+        domain_key_fpr, uid_idx, required_sig_keyid);
+
+    gpgme_release (ctx);
 
     return domain_key_valid;
 }
@@ -60,10 +60,14 @@ Copyright 2011 Kyle L. Huff, CURETHEITCH development team
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <list>
 #include <boost/weak_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include "JSAPIAuto.h"
 #include "BrowserHost.h"
 #include "gpgAuthPlugin.h"
+#include "cache.h"
 
 #ifdef HAVE_W32_SYSTEM
 #include "libs/libgpgme/WINNT_x86-msvc/gpgme.h"
@@ -74,6 +78,7 @@ Copyright 2011 Kyle L. Huff, CURETHEITCH development team
 #endif
 #include "json/json.h"
 #include "fbjson.h"
+#include "trustgraph.h"
 
 #ifndef H_gpgAuthPluginAPI
 #define H_gpgAuthPluginAPI
@@ -100,6 +105,85 @@ struct genSubKeyParams {
     bool auth_flag;
 };
 
+// A buffer held in the handle table
+struct dataHandle {
+    boost::shared_ptr<std::string> data;
+    long refcount;
+};
+
+// The state of a gpgReencryptBatch job, shared by its worker threads
+struct reencryptJob {
+    std::string job_id;
+    std::vector<std::string> items;
+    std::vector<std::string> keyids;
+    bool keep_recipients;
+    boost::optional<FB::VariantMap> options;
+    size_t total;
+    size_t next_item;
+    size_t completed;
+    size_t failed;
+    int max_workers;
+    int active_workers;
+    bool cancelled;
+    boost::mutex mutex;
+};
+typedef boost::shared_ptr<reencryptJob> reencryptJobPtr;
+
+// The state of a gpgSignUIDBatch job, shared by its worker threads. The
+//  items are grouped by target key; every key is signed in one edit.
+struct signUIDJob {
+    std::string job_id;
+    std::string with_keyid;
+    gpgme_key_t signer;
+    std::vector<std::string> keyids;
+    std::vector<gpgme_key_t> keys;
+    std::vector<std::string> key_errors;
+    std::vector<std::vector<size_t> > key_items;
+    std::vector<long> uids;
+    bool check_trustdb;
+    size_t total;
+    size_t next_key;
+    size_t completed;
+    size_t failed;
+    int active_workers;
+    boost::mutex mutex;
+};
+typedef boost::shared_ptr<signUIDJob> signUIDJobPtr;
+
+typedef boost::shared_ptr<trust_graph> trustGraphPtr;
+
+struct fileOpParams {
+    std::string operation;
+    std::string in_path;
+    std::string out_path;
+    std::vector<std::string> keyids;
+    bool sign;
+    int sign_mode;
+};
+
+// A single signature of a gpgSignMulti call; result receives the
+//  gpgSignText response for signer
+struct signMultiParams {
+    FB::VariantList signer;
+    const std::string* data;
+    int sign_mode;
+    boost::optional<FB::VariantMap> options;
+    FB::variant* result;
+};
+
+// A decrypted message held in the decrypt cache; data is the plaintext and
+//  result the remainder of the gpgDecryptVerify response
+struct decryptCacheEntry {
+    std::string data;
+    FB::VariantMap result;
+};
+
+inline void scrub_decrypt_entry(decryptCacheEntry& entry)
+{
+    scrub_string(entry.data);
+    entry.result.clear();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 /// @class  gpgAuthPluginAPI
 ///
@@ -119,11 +203,18 @@ public:
     /// @fn FB::variant gpgAuthPluginAPI::get_webpg_status()
     ///
     /// @brief  Executes gpgAuthPluginAPI::init() to set the status variables and
-    ///         populates the "edit_status" property with the contents of the
-    ///         edit_status constant.
+    ///         populates the "edit_status" property with the transcript of the
+    ///         edit that completed last.
     ///////////////////////////////////////////////////////////////////////////////
     FB::VariantMap get_webpg_status();
 
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::getEditEvents(const boost::optional<FB::VariantMap>& options)
+    ///
+    /// @brief  Returns the recorded prompts and responses of recent key edits.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant getEditEvents(const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
     ///////////////////////////////////////////////////////////////////////////////
     /// @fn void gpgAuthPluginAPI::init()
     ///
@@ -138,6 +229,15 @@ public:
     ///////////////////////////////////////////////////////////////////////////////
     gpgme_ctx_t get_gpgme_ctx();
 
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn int gpgAuthPluginAPI::run_gpg(const std::string& args, const std::string& input, std::string& output)
+    ///
+    /// @brief  Runs the gpg binary of the OpenPGP engine for operations that
+    ///         gpgme does not provide.
+    ///////////////////////////////////////////////////////////////////////////////
+    int run_gpg(const std::string& args, const std::string& input,
+        std::string& output);
+
     ///////////////////////////////////////////////////////////////////////////////
     /// @fn FB::VariantMap gpgAuthPluginAPI::getKeyList(cont std::string& name, int secret_only)
     ///
@@ -248,7 +348,83 @@ public:
     FB::variant getTemporaryPath();
 
     ///////////////////////////////////////////////////////////////////////////////
-    /// @fn FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data, const FB::VariantList& enc_to_keyids, bool sign)
+    /// @fn FB::variant gpgAuthPluginAPI::createHandle(const std::string& data)
+    ///
+    /// @brief  Stores data in the handle table and returns its handle.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant createHandle(const std::string& data);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::readHandle(const std::string& handle)
+    ///
+    /// @brief  Returns the data held by handle.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant readHandle(const std::string& handle);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::retainHandle(const std::string& handle)
+    ///
+    /// @brief  Adds a reference to handle.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant retainHandle(const std::string& handle);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::releaseHandle(const std::string& handle)
+    ///
+    /// @brief  Drops a reference to handle, freeing the data with the last one.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant releaseHandle(const std::string& handle);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn boost::shared_ptr<std::string> gpgAuthPluginAPI::get_handle_data(const std::string& handle)
+    ///
+    /// @brief  Returns the buffer of handle, or NULL if it is not a live
+    ///         handle.
+    ///////////////////////////////////////////////////////////////////////////////
+    boost::shared_ptr<std::string> get_handle_data(const std::string& handle);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::handle_response(const FB::variant& response, const boost::optional<FB::VariantMap>& options, const std::string& field)
+    ///
+    /// @brief  Moves the member field of a successful response into a new
+    ///         handle if options requests "return_handle".
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant handle_response(const FB::variant& response,
+        const boost::optional<FB::VariantMap>& options,
+        const std::string& field="data");
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::setVerifyCacheSize(long size)
+    ///
+    /// @brief  Sets the maximum number of verification results to keep in
+    ///         the verify cache; 0 disables the cache.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant setVerifyCacheSize(long size);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::clearVerifyCache()
+    ///
+    /// @brief  Drops all of the entries in the verify cache.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant clearVerifyCache();
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::setDecryptCacheTimeout(long seconds)
+    ///
+    /// @brief  Enables the in-memory cache of decrypted messages, holding each
+    ///         entry for at most seconds; 0 disables and wipes the cache.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant setDecryptCacheTimeout(long seconds);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::flushDecryptCache()
+    ///
+    /// @brief  Wipes all of the entries in the decrypt cache.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant flushDecryptCache();
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgEncrypt(const std::string& data, const FB::VariantList& enc_to_keyids, bool sign, const boost::optional<FB::VariantMap>& options)
     ///
     /// @brief  Encrypts the data passed in data with the key ids passed in
     ///         enc_to_keyids and optionally signs the data.
@@ -256,12 +432,15 @@ public:
     /// @param  data    The data to encrypt.
     /// @param  enc_to_keyids   A VariantList of key ids to encrypt to (recpients).
     /// @param  sign    The data should be also be signed.
+    /// @param  options An optional object; {"binary": true} returns the raw
+    ///                 OpenPGP packets base64 encoded instead of armored.
     ///////////////////////////////////////////////////////////////////////////////
     FB::variant gpgEncrypt(const std::string& data,
-        const FB::VariantList& enc_to_keyids, bool sign=false);
+        const FB::VariantList& enc_to_keyids, bool sign=false,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
 
     ///////////////////////////////////////////////////////////////////////////////
-    /// @fn FB::variant gpgAuthPluginAPI::gpgSymmetricEncrypt(const std::string& data, bool sign)
+    /// @fn FB::variant gpgAuthPluginAPI::gpgSymmetricEncrypt(const std::string& data, bool sign, const boost::optional<FB::VariantMap>& options)
     ///
     /// @brief  Calls gpgAuthPluginAPI::gpgEncrypt() without any recipients specified
     ///         which initiates a Symmetric encryption method on the gpgme context.
@@ -270,44 +449,191 @@ public:
     /// @param  sign    The data should also be signed. NOTE: Signed symmetric
     ///                 encryption does not work in gpgme v1.3.2; For details,
     ///                 see https://bugs.g10code.com/gnupg/issue1440
+    /// @param  options As for gpgAuthPluginAPI::gpgEncrypt().
     ///////////////////////////////////////////////////////////////////////////////
     FB::variant gpgSymmetricEncrypt(const std::string& data,  
-        bool sign=false);
+        bool sign=false,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgAddRecipients(const std::string& ciphertext, const FB::VariantList& new_keyids, const boost::optional<FB::VariantMap>& options)
+    ///
+    /// @brief  Re-encrypts ciphertext to its existing recipients plus the key
+    ///         ids in new_keyids without passing the plaintext through JS.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgAddRecipients(const std::string& ciphertext,
+        const FB::VariantList& new_keyids,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgReencryptBatch(const FB::VariantList& items, const FB::VariantList& new_keyids, const boost::optional<FB::VariantMap>& options)
+    ///
+    /// @brief  Queues a background job that re-encrypts each of items to
+    ///         new_keyids across a pool of worker threads.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgReencryptBatch(const FB::VariantList& items,
+        const FB::VariantList& new_keyids,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgCancelReencrypt(const std::string& job_id)
+    ///
+    /// @brief  Stops a gpgReencryptBatch job after the items in progress.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgCancelReencrypt(const std::string& job_id);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgResumeReencrypt(const std::string& job_id)
+    ///
+    /// @brief  Restarts a cancelled gpgReencryptBatch job where it stopped.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgResumeReencrypt(const std::string& job_id);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgDiscardReencrypt(const std::string& job_id)
+    ///
+    /// @brief  Forgets a cancelled gpgReencryptBatch job and its messages.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgDiscardReencrypt(const std::string& job_id);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::getReencryptStatus(const std::string& job_id)
+    ///
+    /// @brief  Returns the progress of a gpgReencryptBatch job.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant getReencryptStatus(const std::string& job_id);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::VariantMap gpgAuthPluginAPI::reencryptMessage(const std::string& ciphertext, const std::vector<std::string>& keyids, bool keep_recipients, const boost::optional<FB::VariantMap>& options)
+    ///
+    /// @brief  Decrypts ciphertext and encrypts it again to keyids and,
+    ///         optionally, the original recipients.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::VariantMap reencryptMessage(const std::string& ciphertext,
+        const std::vector<std::string>& keyids, bool keep_recipients,
+        const boost::optional<FB::VariantMap>& options);
 
     ///////////////////////////////////////////////////////////////////////////////
     /// @fn FB::variant gpgAuthPluginAPI::gpgDecryptVerify(const std::string& data, int use_agent)
     ///
     /// @brief  Attempts to decrypt and verify the string data. If use_agent
-    ///         is 0, it will attempt to disable the key-agent to prevent the
-    ///         passphrase dialog from displaying. This is useful in cases where
-    ///         you want to verify or decrypt without unlocking the private keyring
-    ///         (i.e. in an automated parsing environment).
+    ///         is 0, only a verify operation is performed and any passphrase
+    ///         request is refused, so the passphrase dialog is never displayed.
+    ///         This is useful in cases where you want to verify without
+    ///         unlocking the private keyring (i.e. in an automated parsing
+    ///         environment).
     ///
     /// @param  data    The data to decrypt and/or verify.
-    /// @param  use_agent   Attempt to disable the gpg-agent
+    /// @param  use_agent   Use 0 to verify without invoking the gpg-agent
     ///////////////////////////////////////////////////////////////////////////////
     FB::variant gpgDecryptVerify(const std::string& data, int use_agent);
 
     ///////////////////////////////////////////////////////////////////////////////
-    /// @fn FB::variant gpgAuthPluginAPI::gpgDecrypt(const std::string& data)
+    /// @fn FB::variant gpgAuthPluginAPI::gpgDecrypt(const std::string& data, const boost::optional<FB::VariantMap>& options)
     ///
     /// @brief  Calls gpgAuthPluginAPI::gpgDecryptVerify() with the use_agent flag
     ///         specifying to not disable the gpg-agent.
     ///
     /// @param  data    The data to decyrpt.
+    /// @param  options An optional object; {"binary": true} indicates data
+    ///                 holds base64 encoded binary OpenPGP packets.
     ///////////////////////////////////////////////////////////////////////////////
-    FB::variant gpgDecrypt(const std::string& data);
+    FB::variant gpgDecrypt(const std::string& data,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
+    FB::variant gpgVerify(const std::string& data,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
 
-    FB::variant gpgVerify(const std::string& data);
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgVerifyOnly(const std::string& data, bool content_hash)
+    ///
+    /// @brief  Verifies the signed message in data without producing the
+    ///         plaintext, optionally returning the SHA-256 of the signed content.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgVerifyOnly(const std::string& data, bool content_hash);
 
     ///////////////////////////////////////////////////////////////////////////////
-    /// @fn FB::variant gpgAuthPluginAPI::gpgSignText(FB::VariantList& signers, const std::string& plain_text, int sign_mode)
+    /// @fn FB::variant gpgAuthPluginAPI::gpgDecryptPreview(const std::string& data, long max_bytes, const boost::optional<FB::VariantMap>& options)
+    ///
+    /// @brief  Decrypts only the first max_bytes of plaintext of data.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgDecryptPreview(const std::string& data, long max_bytes,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgVerifyDetached(const std::string& signed_data, const std::string& signature, const boost::optional<FB::VariantMap>& options)
+    ///
+    /// @brief  Verifies the detached signature against signed_data.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgVerifyDetached(const std::string& signed_data,
+        const std::string& signature,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::classifyPGPData(const std::string& data, const boost::optional<FB::VariantMap>& options)
+    ///
+    /// @brief  Inspects the first OpenPGP armored block found in data without
+    ///         invoking gpg.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant classifyPGPData(const std::string& data,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::processPGPBlocks(const std::string& text, const std::string& mode)
+    ///
+    /// @brief  Locates every OpenPGP armored block in text and classifies,
+    ///         verifies or decrypts each of them in a single call.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant processPGPBlocks(const std::string& text, const std::string& mode);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgSignText(FB::VariantList& signers, const std::string& plain_text, int sign_mode, const boost::optional<FB::VariantMap>& options)
     ///
     /// @brief  Signs the text specified in plain_text with the key ids specified
     ///         in signers, with the signature mode specified in sign_mode.
     ///////////////////////////////////////////////////////////////////////////////
     FB::variant gpgSignText(const FB::VariantList& signers,
-        const std::string& plain_text, int sign_mode);
+        const std::string& plain_text, int sign_mode,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgSignMulti(const std::string& data, const FB::VariantList& signers, int sign_mode, const boost::optional<FB::VariantMap>& options)
+    ///
+    /// @brief  Signs data separately with each of the keys in signers, running
+    ///         the signatures in parallel, and returns them as an array.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgSignMulti(const std::string& data,
+        const FB::VariantList& signers, int sign_mode,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgEncryptFile(const std::string& in_path, const std::string& out_path, const FB::VariantList& enc_to_keyids, bool sign)
+    ///
+    /// @brief  Queues a threaded operation that encrypts the file at in_path
+    ///         to out_path, letting gpg read and write the files directly.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgEncryptFile(const std::string& in_path,
+        const std::string& out_path, const FB::VariantList& enc_to_keyids,
+        bool sign);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgDecryptFile(const std::string& in_path, const std::string& out_path)
+    ///
+    /// @brief  Queues a threaded operation that decrypts and verifies the file
+    ///         at in_path to out_path.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgDecryptFile(const std::string& in_path,
+        const std::string& out_path);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgSignFile(const std::string& in_path, const std::string& out_path, const FB::VariantList& signers, int sign_mode)
+    ///
+    /// @brief  Queues a threaded operation that signs the file at in_path and
+    ///         writes the result to out_path.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgSignFile(const std::string& in_path,
+        const std::string& out_path, const FB::VariantList& signers,
+        int sign_mode);
 
     ///////////////////////////////////////////////////////////////////////////////
     /// @fn FB::variant gpgAuthPluginAPI::gpgSignUID(const std::string& keyid, long sign_uid, const std::string& with_keyid, long local_only, long trust_sign, long trust_level)
@@ -326,6 +652,17 @@ public:
         const std::string& with_keyid, long local_only=NULL,
         long trust_sign=NULL, long trust_level=NULL);
 
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgSignUIDBatch(const FB::VariantList& items, const std::string& with_keyid, const boost::optional<FB::VariantMap>& options)
+    ///
+    /// @brief  Queues a background job that signs the UIDs listed in items
+    ///         with the key with_keyid, one edit per target key, across a
+    ///         pool of worker threads.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgSignUIDBatch(const FB::VariantList& items,
+        const std::string& with_keyid,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
     ///////////////////////////////////////////////////////////////////////////////
     /// @fn FB::variant gpgAuthPluginAPI::gpgDeleteUIDSign(const std::string& keyid, long uid, long signature)
     ///
@@ -399,13 +736,16 @@ public:
     void threaded_gpgGenSubKey(genSubKeyParams params);
 
     ///////////////////////////////////////////////////////////////////////////////
-    /// @fn FB::variant gpgAuthPluginAPI::gpgImportKey(const std::string& ascii_key)
+    /// @fn FB::variant gpgAuthPluginAPI::gpgImportKey(const std::string& ascii_key, const boost::optional<FB::VariantMap>& options)
     ///
     /// @brief  Imports the ASCII encoded key ascii_key
     ///
     /// @param  ascii_key   An armored, ascii encoded PGP Key block.
+    /// @param  options An optional object; "handle" names a handle to read
+    ///                 the key from.
     ///////////////////////////////////////////////////////////////////////////////
-    FB::variant gpgImportKey(const std::string& ascii_key);
+    FB::variant gpgImportKey(const std::string& ascii_key,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
 
     ///////////////////////////////////////////////////////////////////////////////
     /// @fn FB::variant gpgAuthPluginAPI::gpgDeleteKey(const std::string& keyid, int allow_secret)
@@ -475,6 +815,21 @@ public:
     ///////////////////////////////////////////////////////////////////////////////
     FB::variant gpgSetKeyTrust(const std::string& keyid, long trust_level);
 
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgImportOwnerTrust(const FB::VariantList& table)
+    ///
+    /// @brief  Assigns the owner trust of all keys in table with one gpg run,
+    ///         keeping the disabled flag unless "disabled" is given.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgImportOwnerTrust(const FB::VariantList& table);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgExportOwnerTrust()
+    ///
+    /// @brief  Returns the owner trust assigned to all keys.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgExportOwnerTrust();
+
     ///////////////////////////////////////////////////////////////////////////////
     /// @fn FB::variant gpgAuthPluginAPI::gpgAddUID(const std::string& keyid, const std::string& name,
     ///     const std::string& email, const std::string& comment)
@@ -544,11 +899,12 @@ public:
         long expire);
 
     ///////////////////////////////////////////////////////////////////////////////
-    /// @fn FB::variant gpgAuthPluginAPI::gpgExportPublicKey(const std::string& keyid)
+    /// @fn FB::variant gpgAuthPluginAPI::gpgExportPublicKey(const std::string& keyid, const boost::optional<FB::VariantMap>& options)
     ///
     /// @brief  Exports the public key specified with keyid as an armored ASCII encoded PGP Block.
     ///////////////////////////////////////////////////////////////////////////////
-    FB::variant gpgExportPublicKey(const std::string& keyid);
+    FB::variant gpgExportPublicKey(const std::string& keyid,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
 
     ///////////////////////////////////////////////////////////////////////////////
     /// @fn FB::variant gpgAuthPluginAPI::gpgRevokeItem(const std::string& keyid, const std::string& item, int key_idx,
@@ -620,10 +976,58 @@ public:
     ///////////////////////////////////////////////////////////////////////////////
     FB::variant gpgChangePassphrase(const std::string& keyid);
 
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::gpgEditKeyBatch(const std::string& keyid, const FB::VariantList& commands)
+    ///
+    /// @brief  Applies a sequence of edits to the key specified with keyid in a
+    ///         single gpg edit session and saves once.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant gpgEditKeyBatch(const std::string& keyid,
+        const FB::VariantList& commands);
+
     int verifyDomainKey(const std::string& domain, 
         const std::string& domain_key_fpr, long uid_idx,
         const std::string& required_sig_keyid);
 
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::verifyDomainKeyBatch(const std::string& domain, const std::string& domain_key_fpr, long uid_idx, const FB::VariantList& required_sig_keyids)
+    ///
+    /// @brief  Performs verifyDomainKey() for each of the trusted key ids in
+    ///         required_sig_keyids in one pass and returns the best result
+    ///         with the result for each key.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant verifyDomainKeyBatch(const std::string& domain,
+        const std::string& domain_key_fpr, long uid_idx,
+        const FB::VariantList& required_sig_keyids);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::variant gpgAuthPluginAPI::findTrustPath(const std::string& target_fpr, long max_depth, const boost::optional<FB::VariantMap>& options)
+    ///
+    /// @brief  Returns the validity gpg gives target_fpr and the shortest chain
+    ///         of fully valid introducers from an ultimately trusted key to it.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::variant findTrustPath(const std::string& target_fpr, long max_depth,
+        const boost::optional<FB::VariantMap>& options=boost::optional<FB::VariantMap>());
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn int gpgAuthPluginAPI::evaluateDomainKey(trustGraphPtr graph, const std::string& domain, const std::string& domain_key_fpr, long uid_idx, const std::string& required_sig_keyid)
+    ///
+    /// @brief  Evaluates verifyDomainKey() against graph.
+    ///////////////////////////////////////////////////////////////////////////////
+    int evaluateDomainKey(trustGraphPtr graph, const std::string& domain,
+        const std::string& domain_key_fpr, long uid_idx,
+        const std::string& required_sig_keyid);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn int gpgAuthPluginAPI::verifyDomainKeyDirect(const std::string& domain, const std::string& domain_key_fpr, long uid_idx, const std::string& required_sig_keyid)
+    ///
+    /// @brief  Evaluates verifyDomainKey() with gpg lookups instead of the
+    ///         signature graph.
+    ///////////////////////////////////////////////////////////////////////////////
+    int verifyDomainKeyDirect(const std::string& domain,
+        const std::string& domain_key_fpr, long uid_idx,
+        const std::string& required_sig_keyid);
+
     ///////////////////////////////////////////////////////////////////////////////
     /// @fn std::string gpgAuthPluginAPI::get_version()
     ///
@@ -640,6 +1044,74 @@ public:
 
     std::string original_gpg_config;
 
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn std::string gpgAuthPluginAPI::get_gnupg_homedir()
+    ///
+    /// @brief  Determines the directory gpg will use as its homedir.
+    ///////////////////////////////////////////////////////////////////////////////
+    std::string get_gnupg_homedir();
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn std::string gpgAuthPluginAPI::get_keyring_stamp()
+    ///
+    /// @brief  Returns a stamp of the homedir, keyrings and trustdb in use;
+    ///         any change to these produces a different stamp.
+    ///////////////////////////////////////////////////////////////////////////////
+    std::string get_keyring_stamp();
+
+    // Verification results keyed by the SHA-256 of the verified data
+    lru_cache<FB::variant> verify_cache;
+    boost::mutex verify_cache_mutex;
+
+    // Decrypted messages keyed by the SHA-256 of the ciphertext; disabled
+    //  while decrypt_cache_timeout is 0
+    lru_cache<decryptCacheEntry> decrypt_cache;
+    long decrypt_cache_timeout;
+    boost::mutex decrypt_cache_mutex;
+
+    // Buffers returned to javascript as handles, by handle
+    std::map<std::string, dataHandle> handles;
+    unsigned long handle_counter;
+    boost::mutex handles_mutex;
+
+    // The gpgReencryptBatch jobs by job id
+    std::map<std::string, reencryptJobPtr> reencrypt_jobs;
+    unsigned long reencrypt_job_counter;
+    boost::mutex reencrypt_jobs_mutex;
+    // The ids of the cancelled jobs that can be resumed, oldest first
+    std::list<std::string> reencrypt_resumable;
+
+    // The number of running background workers of gpgReencryptBatch,
+    //  gpgSignUIDBatch and the file operations; the destructor sets
+    //  shutting_down and waits for workers_done until none are left
+    int running_workers;
+    bool shutting_down;
+    boost::mutex workers_mutex;
+    boost::condition_variable workers_done;
+
+    // The number of gpgSignUIDBatch jobs started, guarded by sign_uid_jobs_mutex
+    unsigned long sign_uid_job_counter;
+    boost::mutex sign_uid_jobs_mutex;
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn trustGraphPtr gpgAuthPluginAPI::get_trust_graph()
+    ///
+    /// @brief  Returns the signature graph of the current keyring, rebuilding
+    ///         it if the keyring has changed.
+    ///////////////////////////////////////////////////////////////////////////////
+    trustGraphPtr get_trust_graph();
+
+    // The signature graph of the keyring, see get_trust_graph(); the mutex
+    //  also guards trust_graph::validity_memo
+    trustGraphPtr trust_graph_cache;
+    unsigned long trust_graph_generation;
+    boost::mutex trust_graph_mutex;
+
+    // verifyDomainKey() results, by domain, domain key, UID index and
+    //  required key; only valid for the graph generation they were stored with
+    lru_cache<int> domain_key_memo;
+    boost::mutex domain_key_memo_mutex;
+
     ///////////////////////////////////////////////////////////////////////////////
     /// @fn void gpgAuthPluginAPI::progress_cb(void *self, const char *what, int type, int current, int total)
     ///
@@ -716,6 +1188,110 @@ public:
         api->threaded_gpgGenKey(params);
     };
 
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn FB::VariantMap gpgAuthPluginAPI::gpgFileWorker(const fileOpParams& params)
+    ///
+    /// @brief  Runs the file based encrypt, decrypt or sign operation
+    ///         described by params.
+    ///////////////////////////////////////////////////////////////////////////////
+    FB::VariantMap gpgFileWorker(const fileOpParams& params);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn void gpgAuthPluginAPI::threaded_gpgFileOperation(fileOpParams params)
+    ///
+    /// @brief  Calls gpgAuthPluginAPI::gpgFileWorker() and fires the
+    ///         onfilecomplete event with the result.
+    ///////////////////////////////////////////////////////////////////////////////
+    void threaded_gpgFileOperation(fileOpParams params);
+
+    static void fileOpThreadCaller(gpgAuthPluginAPI* api,
+        fileOpParams params)
+    {
+        api->threaded_gpgFileOperation(params);
+        api->worker_finished();
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn void gpgAuthPluginAPI::worker_started()
+    ///
+    /// @brief  Counts a background worker; called before its thread is
+    ///         created, so that the destructor waits for it.
+    ///////////////////////////////////////////////////////////////////////////////
+    void worker_started();
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn void gpgAuthPluginAPI::worker_finished()
+    ///
+    /// @brief  Called by a background worker as the last use of this object.
+    ///////////////////////////////////////////////////////////////////////////////
+    void worker_finished();
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn bool gpgAuthPluginAPI::is_shutting_down()
+    ///
+    /// @brief  Returns true once the destructor waits for the workers.
+    ///////////////////////////////////////////////////////////////////////////////
+    bool is_shutting_down();
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn void gpgAuthPluginAPI::startReencryptWorkers(reencryptJobPtr job)
+    ///
+    /// @brief  Starts the worker threads for the remaining items of job.
+    ///////////////////////////////////////////////////////////////////////////////
+    void startReencryptWorkers(reencryptJobPtr job);
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn void gpgAuthPluginAPI::threaded_gpgReencrypt(reencryptJobPtr job)
+    ///
+    /// @brief  A worker of a gpgReencryptBatch job; takes items from job until
+    ///         none are left or the job is cancelled.
+    ///////////////////////////////////////////////////////////////////////////////
+    void threaded_gpgReencrypt(reencryptJobPtr job);
+
+    static void reencryptThreadCaller(gpgAuthPluginAPI* api,
+        reencryptJobPtr job)
+    {
+        api->threaded_gpgReencrypt(job);
+        api->worker_finished();
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn void gpgAuthPluginAPI::threaded_gpgSignUIDBatch(signUIDJobPtr job)
+    ///
+    /// @brief  A worker of a gpgSignUIDBatch job; signs the UIDs of one target
+    ///         key after the other until none are left.
+    ///////////////////////////////////////////////////////////////////////////////
+    void threaded_gpgSignUIDBatch(signUIDJobPtr job);
+
+    static void signUIDThreadCaller(gpgAuthPluginAPI* api,
+        signUIDJobPtr job)
+    {
+        api->threaded_gpgSignUIDBatch(job);
+        api->worker_finished();
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn void gpgAuthPluginAPI::threaded_gpgSignMulti(signMultiParams params)
+    ///
+    /// @brief  Creates one of the signatures of a gpgSignMulti call.
+    ///////////////////////////////////////////////////////////////////////////////
+    void threaded_gpgSignMulti(signMultiParams params);
+
+    static void signMultiThreadCaller(gpgAuthPluginAPI* api,
+        signMultiParams params)
+    {
+        api->threaded_gpgSignMulti(params);
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////
+    /// @fn void gpgAuthPluginAPI::file_progress_cb(void *self, const char *what, int type, int current, int total)
+    ///
+    /// @brief  Relays the gpg progress of a file operation as the
+    ///         onfileprogress event.
+    ///////////////////////////////////////////////////////////////////////////////
+    static void file_progress_cb(void *self, const char *what, int type,
+        int current, int total);
+
     ///////////////////////////////////////////////////////////////////////////////
     /// @fn FB::variant gpgAuthPluginAPI::gpgGenSubKeyWorker(const std::string& keyid, const std::string& subkey_type,
     ///         const std::string& subkey_length, const std::string& subkey_expire, bool sign_flag,
@@ -4,6 +4,10 @@
 
 #include <stdlib.h>
 #include <iostream>
+#include <vector>
+#include <map>
+#include <time.h>
+#include <boost/thread/mutex.hpp>
 
 // GNUGPGHOME need only be populated and all future context init's will use
 //  the path as homedir for gpg
@@ -13,77 +17,354 @@
 std::string GNUPGHOME;
 //#endif
 
-// A global holder for the current edit_fnc status
-std::string edit_status;
-
-/* Global variables for the handling of UID signing or
-    deleting signatures on UIDs */
-
-// subkey_type
-std::string gen_subkey_type;
-
-// subkey_length
-std::string gen_subkey_length;
+/* The prompts gpg raises during an edit. The ids index edit_prompts; a
+    prompt is interned once per status line by edit_prompt_lookup and then
+    dispatched without further string comparisons. */
+enum edit_prompt_id {
+    EDIT_PROMPT_UNKNOWN = 0,
+    EDIT_PROMPT_KEYEDIT,
+    EDIT_PROMPT_SAVE_OKAY,
+    EDIT_PROMPT_PASSPHRASE,
+    EDIT_PROMPT_SIGN_UID_OKAY,
+    EDIT_PROMPT_TRUSTSIG_VALUE,
+    EDIT_PROMPT_TRUSTSIG_DEPTH,
+    EDIT_PROMPT_TRUSTSIG_REGEXP,
+    EDIT_PROMPT_DELSIG_VALID,
+    EDIT_PROMPT_DELSIG_INVALID,
+    EDIT_PROMPT_DELSIG_UNKNOWN,
+    EDIT_PROMPT_DELSIG_SELFSIG,
+    EDIT_PROMPT_OWNERTRUST_VALUE,
+    EDIT_PROMPT_OWNERTRUST_ULTIMATE,
+    EDIT_PROMPT_KEYGEN_NAME,
+    EDIT_PROMPT_KEYGEN_EMAIL,
+    EDIT_PROMPT_KEYGEN_COMMENT,
+    EDIT_PROMPT_KEYGEN_ALGO,
+    EDIT_PROMPT_KEYGEN_FLAGS,
+    EDIT_PROMPT_KEYGEN_SIZE,
+    EDIT_PROMPT_KEYGEN_VALID,
+    EDIT_PROMPT_REMOVE_UID_OKAY,
+    EDIT_PROMPT_REMOVE_SUBKEY_OKAY,
+    EDIT_PROMPT_REVOKE_SUBKEY_OKAY,
+    EDIT_PROMPT_REVOKE_UID_OKAY,
+    EDIT_PROMPT_REVOKE_SIG_ONE,
+    EDIT_PROMPT_REVOKE_SIG_OKAY,
+    EDIT_PROMPT_REASON_CODE,
+    EDIT_PROMPT_REASON_TEXT,
+    EDIT_PROMPT_REASON_OKAY,
+    EDIT_PROMPT_COUNT
+};
+
+#define EDIT_JOURNAL_EVENTS 256
+#define EDIT_JOURNAL_OPS 32
+#define EDIT_EVENT_TEXT 64
+
+/* A prompt of an edit and the response given to it */
+struct edit_event {
+    unsigned long seq;
+    unsigned long op_id;
+    edit_prompt_id prompt;
+    int step;
+    // false for a prompt the edit did not know how to answer; text then
+    //  holds the prompt instead of the response
+    bool answered;
+    time_t timestamp;
+    char text[EDIT_EVENT_TEXT];
+};
+
+/* An edit operation: the call that started it and how it ended */
+struct edit_op {
+    edit_op() : op_id(0), first_seq(0), started(0), finished(0), error(0) {}
+
+    unsigned long op_id;
+    std::string call;
+    unsigned long first_seq;
+    time_t started;
+    time_t finished;
+    gpgme_error_t error;
+};
+
+inline const char *edit_prompt_name (edit_prompt_id id);
+
+////////////////////////////////////////////////////////////////////////////////
+/// @class  edit_journal
+///
+/// @brief  A fixed size ring of the events of all edits and of the
+///         operations they belong to. Recording an event copies at most
+///         EDIT_EVENT_TEXT bytes into a preallocated slot, so the cost is
+///         constant and the memory bounded; the oldest events and
+///         operations are overwritten once the ring is full.
+////////////////////////////////////////////////////////////////////////////////
+class edit_journal
+{
+public:
+    edit_journal() : m_next_seq(1), m_next_op(1), m_last_op(0)
+    {
+        memset (m_events, 0, sizeof(m_events));
+    }
 
-// subkey_expire
-std::string gen_subkey_expire;
+    // Starts an operation and returns its id
+    unsigned long begin(const std::string& call)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        unsigned long op_id = m_next_op++;
+        edit_op& op = m_ops[op_id % EDIT_JOURNAL_OPS];
+
+        op.op_id = op_id;
+        op.call = call;
+        op.first_seq = m_next_seq;
+        op.started = time(NULL);
+        op.finished = 0;
+        op.error = 0;
+
+        return op_id;
+    }
 
-// Flags for subkey generation
-bool gen_sign_flag;
-bool gen_enc_flag;
-bool gen_auth_flag;
+    void record(unsigned long op_id, edit_prompt_id prompt, int step,
+        const char *text, bool answered)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        unsigned long seq = m_next_seq++;
+        edit_event& event = m_events[seq % EDIT_JOURNAL_EVENTS];
+
+        event.seq = seq;
+        event.op_id = op_id;
+        event.prompt = prompt;
+        event.step = step;
+        event.answered = answered;
+        event.timestamp = time(NULL);
+        strncpy (event.text, text, EDIT_EVENT_TEXT - 1);
+        event.text[EDIT_EVENT_TEXT - 1] = '\0';
+    }
 
-// index number of the UID which contains the signature to delete/revoke
-std::string current_uid;
+    // Marks an operation as completed with error
+    void finish(unsigned long op_id, gpgme_error_t error)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        edit_op *op = find_op(op_id);
 
-// index number for the signature to select
-std::string current_sig;
+        if (op) {
+            op->finished = time(NULL);
+            op->error = error;
+        }
+        m_last_op = op_id;
+        keyring_changed();
+    }
 
-// trust value to assign
-std::string trust_assignment;
+    // The id of the operation that completed last
+    unsigned long last_op()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_last_op;
+    }
 
-// uid name to create
-std::string genuid_name;
+    // Renders the call and the retained events of an operation as text
+    std::string transcript(unsigned long op_id)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        const edit_op *op = find_op(op_id);
+        std::string text;
+        char step[16];
+
+        if (!op)
+            return text;
+
+        text = op->call + "\n";
+        unsigned long seq = op->first_seq;
+        if (seq < oldest_seq()) {
+            // The first events of the operation have been overwritten
+            seq = oldest_seq();
+            text += " ...;";
+        }
 
-// uid email to assign
-std::string genuid_email;
+        for (; seq < m_next_seq; seq++) {
+            const edit_event& event = m_events[seq % EDIT_JOURNAL_EVENTS];
+            if (event.op_id != op_id)
+                continue;
+            sprintf (step, "%d", event.step);
+            if (event.answered)
+                text += std::string(" ") + edit_prompt_name (event.prompt)
+                    + ", case " + step + ": response: " + event.text + ";";
+            else
+                text += std::string(" ") + event.text + ", case " + step
+                    + ": we should never reach here;";
+        }
 
-// uid comment to assign
-std::string genuid_comment;
+        return text;
+    }
 
-// Used as iter count for current signature index
-static int signature_iter;
+    // Copies the retained events with a sequence number above after_seq,
+    //  of op_id only unless it is 0, and returns the next sequence number
+    unsigned long events(unsigned long after_seq, unsigned long op_id,
+        std::vector<edit_event>& events)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        unsigned long seq = after_seq + 1;
+
+        if (seq < oldest_seq())
+            seq = oldest_seq();
+        for (; seq < m_next_seq; seq++) {
+            const edit_event& event = m_events[seq % EDIT_JOURNAL_EVENTS];
+            if (!op_id || event.op_id == op_id)
+                events.push_back(event);
+        }
 
-// Used as iter count for current notation/description line
-static int text_line;
+        return m_next_seq;
+    }
 
-// Used to store the index for the key/subkey
-//  0: Public Key
-//  1 &>: Subkeys
-std::string key_index;
+    // Copies the retained operations, oldest first
+    void ops(std::vector<edit_op>& ops)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        unsigned long op_id = m_next_op > EDIT_JOURNAL_OPS ?
+            m_next_op - EDIT_JOURNAL_OPS : 1;
 
-// Used to store the value for the new expiration
-std::string expiration;
+        for (; op_id < m_next_op; op_id++)
+            ops.push_back(m_ops[op_id % EDIT_JOURNAL_OPS]);
+    }
 
-// Used to store the type of item to revoke
-std::string revitem;
+private:
+    unsigned long oldest_seq() const
+    {
+        return m_next_seq > EDIT_JOURNAL_EVENTS ?
+            m_next_seq - EDIT_JOURNAL_EVENTS : 1;
+    }
 
-// Used to store the index of the of the revocation reason
-// 0: No reason specified
-// 1: Key has been compromised
-// 2: Key is superseded
-// 3: Key is no longer used
-// -- UID revocation --
-// 4: User ID is no longer used
-std::string reason_index;
+    edit_op *find_op(unsigned long op_id)
+    {
+        edit_op& op = m_ops[op_id % EDIT_JOURNAL_OPS];
+        return (op_id && op.op_id == op_id) ? &op : NULL;
+    }
 
-// Used to store the revocation description
-std::string description;
+    boost::mutex m_mutex;
+    edit_event m_events[EDIT_JOURNAL_EVENTS];
+    edit_op m_ops[EDIT_JOURNAL_OPS];
+    unsigned long m_next_seq;
+    unsigned long m_next_op;
+    unsigned long m_last_op;
+};
+
+// The journal of all edits; the last completed edit is reported as the
+//  edit_status of webpg_status
+edit_journal edit_events;
+
+/* A single command of an edit: the responses to give to successive
+    keyedit.prompt lines, and the arguments for the prompts the command
+    raises. An edit runs one or more commands and then saves. */
+struct edit_command {
+    edit_command()
+        : gen_sign_flag(false), gen_enc_flag(false), gen_auth_flag(false),
+          signature_iter(0), report_status(false), passphrase_error(false) {}
+
+    std::string name;
+    std::vector<std::string> prompts;
+
+    // index number for the signature to select
+    std::string current_sig;
+
+    // trust value to assign
+    std::string trust_assignment;
+
+    // uid name, email and comment to create
+    std::string genuid_name;
+    std::string genuid_email;
+    std::string genuid_comment;
+
+    // Used to store the value for the new expiration of a key or subkey
+    std::string expiration;
+
+    // Used to store the index of the of the revocation reason
+    // 0: No reason specified
+    // 1: Key has been compromised
+    // 2: Key is superseded
+    // 3: Key is no longer used
+    // -- UID revocation --
+    // 4: User ID is no longer used
+    std::string reason_index;
+
+    // Used to store the revocation description
+    std::string description;
+
+    // The type and length of a subkey to create
+    std::string gen_subkey_type;
+    std::string gen_subkey_length;
+
+    // Flags for subkey generation
+    bool gen_sign_flag;
+    bool gen_enc_flag;
+    bool gen_auth_flag;
+
+    // The index the first signature offered for selection is counted as
+    int signature_iter;
+
+    // Record the last status seen as the refusal of this command if gpg
+    //  returns to the keyedit.prompt directly after its final prompt
+    bool report_status;
+
+    // Fail with GPG_ERR_BAD_PASSPHRASE if gpg asks for a passphrase
+    bool passphrase_error;
+};
+
+/* The commands and progress of a single gpgme_op_edit operation.
+
+    An instance is passed to edit_fnc through the opaque pointer of
+    gpgme_op_edit, so every edit carries its own step counters and
+    arguments and any number of edits can run at the same time. */
+struct edit_state {
+    edit_state()
+        : command(NULL), step(0), flag_step(0), signature_iter(0),
+          current_sig(-1), text_line(1), trust_tries(0),
+          status_result((gpgme_status_code_t) 0), op_id(0),
+          command_idx(0) {}
+
+    // The command whose arguments answer the current prompts
+    const edit_command *command;
+
+    // Used to keep track of the current edit iteration
+    int step;
+    int flag_step;
+
+    // Used as iter count for current signature index, and the index of
+    //  the signature still to select (-1 once it has been selected)
+    int signature_iter;
+    int current_sig;
+
+    // Used as iter count for current notation/description line
+    int text_line;
+
+    // The number of times the ownertrust value has been requested
+    int trust_tries;
+
+    // The last response given and the last status seen
+    std::string prior_response;
+    gpgme_status_code_t status_result;
+
+    // The id of this edit in edit_events
+    unsigned long op_id;
+
+    // The commands of the edit and the index of the next one to start
+    std::vector<edit_command> commands;
+    size_t command_idx;
+
+    // The status with which gpg refused a command, by command index
+    std::map<size_t, gpgme_status_code_t> refused;
+};
+
+/* Appends a command to state that answers successive keyedit.prompt lines
+    with the given responses; NULL ends the list */
+inline edit_command&
+edit_add_command (edit_state& state, const std::string& name,
+    const char *first, const char *second=NULL, const char *third=NULL)
+{
+    const char *prompts[] = { first, second, third };
+    edit_command command;
 
-// Used to keep track of the current edit iteration
-static int step = 0;
+    command.name = name;
+    for (size_t i = 0; i < 3 && prompts[i]; i++)
+        command.prompts.push_back(prompts[i]);
+    state.commands.push_back(command);
 
-static int flag_step = 0;
+    return state.commands.back();
+}
 
 /* An inline method to convert an integer to a string */
 inline
@@ -94,866 +375,357 @@ std::string i_to_str(const int &number)
    return oss.str();
 }
 
-// Create a dummy passphrase callback for instances where we cannot prevent
-//  the agent from prompting the user when we are merely attempting to verify
-//  a PGP block (this is needed for GPG2 on Windows)
+// Create a passphrase callback for instances where we must not prompt the
+//  user when we are merely attempting to verify a PGP block. Any request for
+//  a passphrase is refused, which cancels the operation on that context only
+//  (no gpg.conf or environment changes are required).
 gpgme_error_t
 passphrase_cb (void *opaque, const char *uid_hint, const char *passphrase_info,
 	       int last_was_bad, int fd)
 {
+    return gpgme_error (GPG_ERR_CANCELED);
+}
+
+/* Writes response to the command fd of an edit and records it in
+    edit_events */
+inline void
+edit_respond (edit_state *state, edit_prompt_id prompt, const char *response,
+    int fd)
+{
+    edit_events.record (state->op_id, prompt, state->step, response, true);
 #ifdef HAVE_W32_SYSTEM
     DWORD written;
+    WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
     WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
 #else
-    int res;
-    std::string pass = "\n";
-    int passlen = pass.length();
-    int off = 0;
-
-    do {
-        res = write (fd, &pass[off], passlen - off);
-        if (res > 0)
-        off += res;
-    }
-    while (res > 0 && off != passlen);
-
-    return off == passlen ? 0 : gpgme_error_from_errno (errno);
+    ssize_t write_result;
+    write_result = write (fd, response, strlen (response));
+    write_result = write (fd, "\n", 1);
 #endif
-
-  return 0;
 }
 
-gpgme_error_t
-edit_fnc_sign (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+/* Records a prompt the edit does not know how to answer */
+inline gpgme_error_t
+edit_unexpected (edit_state *state, const char *args, int line)
 {
-    /* this is stores the response to a questions that arise during
-        the edit loop - it is what the user would normally type while
-        using `gpg --edit-key`. To test the prompts and their output,
-        you can execute GnuPG this way:
-            gpg --command-fd 0 --status-fd 2 --edit-key <KEY ID>
-     */
-    char *response = NULL;
-    int error = GPG_ERR_NO_ERROR;
-    static std::string prior_response = "";
-    static gpgme_status_code_t status_result;
-
-    if (status != 49 && status != 51)
-        status_result = status;
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    response = (char *) "fpr";
-                    break;
-
-                case 1:
-                    response = (char *) current_uid.c_str();
-                    break;
-
-                case 2:
-                    response = (char *) "tlsign";
-                    break;
-
-                default:
-                    if (status_result && prior_response == "tlsign")
-                        error = status_result; // there is a problem...
-                    prior_response = "";
-                    step = 0;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        }
-        else if (!strcmp (args, "keyedit.save.okay"))
-            response = (char *) "Y";
-        else if (!strcmp (args, "trustsig_prompt.trust_value"))
-            response = (char *) "1";
-        else if (!strcmp (args, "trustsig_prompt.trust_depth"))
-            response = (char *) "1";
-        else if (!strcmp (args, "trustsig_prompt.trust_regexp"))
-            response = (char *) "";
-        else if (!strcmp (args, "sign_uid.okay"))
-            response = (char *) "y";
-        else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-            error = GPG_ERR_BAD_PASSPHRASE;
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
-    }
-
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-        prior_response = response;
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
-    }
-    return error;
+    fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", line);
+    edit_events.record (state->op_id, EDIT_PROMPT_UNKNOWN, state->step, args,
+        false);
+    return 1;
 }
 
+/* Generates the response to a prompt from the state of the edit; a
+    generator may set error to end the edit with that error */
+typedef const char *(*edit_responder) (edit_state *state, gpgme_error_t *error);
 
-gpgme_error_t
-edit_fnc_delsign (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+/* keyedit.prompt: give the next response of the current command, loading
+    the arguments of a command as it starts, and quit once all commands
+    have been given */
+inline const char *
+edit_respond_command (edit_state *state, gpgme_error_t *error)
 {
-  /* this works for deleting signatures -
-    you must populate the global variables before calling this method for this to work -
-        current_uid = <the index of the UID which has the signature you wish to delete>
-        current_sig = <the index of signature you wish to delete>  */
-    char *response = NULL;
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    response = (char *) "fpr";
-                    break;
-
-                case 1:
-                    signature_iter = 1;
-                    response = (char *) current_uid.c_str();
-                    break;
-
-                case 2:
-                    response = (char * ) "delsig";
-                    break;
-
-                default:
-                    step = 0;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "keyedit.save.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "keyedit.delsig.valid") || 
-            !strcmp (args, "keyedit.delsig.invalid") ||
-            !strcmp (args, "keyedit.delsig.unknown")) {
-            if (signature_iter == atoi(current_sig.c_str())) {
-                response = (char *) "y";
-                current_sig = "0";
-                current_uid = "0";
-                signature_iter = 0;
-            } else {
-                response = (char *) "n";
-            }
-            signature_iter++;
-        } else if (!strcmp (args, "keyedit.delsig.selfsig")) {
-            response = (char *) "y";
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
+    if (state->command) {
+        size_t idx = state->command - &state->commands[0];
+
+        // gpg returned to the prompt straight after the final response of
+        //  the command; it refused the command
+        if (state->command->report_status && state->status_result
+            && state->step == 0
+            && state->prior_response == state->command->prompts.back())
+            state->refused[idx] = state->status_result;
+
+        // A refused final command fails the edit
+        if (state->command_idx >= state->commands.size()
+            && state->refused.count(idx))
+            *error = state->refused[idx]; // there is a problem...
     }
 
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
+    if (state->command_idx >= state->commands.size())
+        return "quit";
+
+    const edit_command& command = state->commands[state->command_idx];
+    if (state->step == 0) {
+        state->command = &command;
+        state->status_result = (gpgme_status_code_t) 0;
+        state->flag_step = 0;
+        state->signature_iter = command.signature_iter;
+        state->current_sig = command.current_sig.length() ?
+            atoi(command.current_sig.c_str()) : -1;
+        state->text_line = 1;
+        state->trust_tries = 0;
     }
-    return 0;
-}
 
-gpgme_error_t
-edit_fnc_disable (void *opaque, gpgme_status_code_t status, const char *args, int fd)
-{
-  /* this works for disabling keys */
-    char *response = NULL;
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    response = (char *) "disable";
-                    break;
-
-                default:
-                    step = -1;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "keyedit.save.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
+    const char *response = command.prompts[state->step].c_str();
+    state->step++;
+    if (state->step >= (int) command.prompts.size()) {
+        state->command_idx++;
+        state->step = 0;
     }
+    return response;
+}
 
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
-    }
-    return 0;
+inline const char *
+edit_respond_passphrase (edit_state *state, gpgme_error_t *error)
+{
+    // all I/O of passphrases should happen with the agent
+    if (state->command->passphrase_error)
+        *error = GPG_ERR_BAD_PASSPHRASE;
+    return "";
 }
 
-gpgme_error_t
-edit_fnc_enable (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+/* Answers yes for the signature at current_sig and no for all others */
+inline const char *
+edit_select_signature (edit_state *state, const char *yes, const char *no)
 {
-  /* this enableds a disabled key  */
-    char *response = NULL;
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    response = (char *) "enable";
-                    break;
-
-                default:
-                    step = -1;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "keyedit.save.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
-    }
+    const char *response = no;
 
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
+    if (state->signature_iter == state->current_sig) {
+        response = yes;
+        state->current_sig = -1;
     }
-    return 0;
+    state->signature_iter++;
+    return response;
 }
 
-gpgme_error_t
-edit_fnc_assign_trust (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+inline const char *
+edit_respond_delsig (edit_state *state, gpgme_error_t *error)
 {
-  /* this assigns the trust to the key 
-        the string trust_assignment must be populated before calling this method */
-    char *response = NULL;
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    response = (char *) "trust";
-                    break;
-
-                default:
-                    step = 0;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "edit_ownertrust.value")) {
-            if (step < 15) {
-                response = (char *) trust_assignment.c_str();
-                step++;
-            } else {
-                response = (char *) "m";
-            }
-        } else if (!strcmp (args, "edit_ownertrust.set_ultimate.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
-    }
-
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
-    }
-    return 0;
+    return edit_select_signature (state, "y", "n");
 }
 
-gpgme_error_t
-edit_fnc_add_uid (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+inline const char *
+edit_respond_revsig (edit_state *state, gpgme_error_t *error)
 {
-  /* this creates a new UID for the given Key
-        the strings genuid_name, genuid_email and genuid_comment must be populated before calling this method */
-
-    char *response = NULL;
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    response = (char *) "adduid";
-                    break;
-
-                default:
-                    step = -1;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "keygen.name")) {
-            response = (char *) genuid_name.c_str();
-        } else if (!strcmp (args, "keygen.email")) {
-            if (strlen (genuid_email.c_str()) > 1) {
-                response = (char *) genuid_email.c_str();
-            } else {
-                response = (char *) "";
-            }
-        } else if (!strcmp (args, "keygen.comment")) {
-            if (strlen (genuid_comment.c_str()) > 1) {
-                response = (char *) genuid_comment.c_str();
-            } else {
-                response = (char *) "";
-            }
-        } else if (!strcmp (args, "keyedit.save.okay")) {
-            response = (char *) "Y";
-            step = 0;
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
-    }
+    return edit_select_signature (state, "Y", "N");
+}
 
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
-    }
-    return 0;
+inline const char *
+edit_respond_ownertrust (edit_state *state, gpgme_error_t *error)
+{
+    if (state->trust_tries >= 15)
+        return "m";
+    state->trust_tries++;
+    return state->command->trust_assignment.c_str();
 }
 
-gpgme_error_t
-edit_fnc_delete_uid (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+inline const char *
+edit_respond_uid_name (edit_state *state, gpgme_error_t *error)
 {
-  /* this deletes a UID for the given Key
-        the string current_uid must be populated before calling this method */
-
-    char *response = NULL;
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    response = (char *) current_uid.c_str();
-                    break;
-
-                case 1:
-                	response = (char *) "deluid";
-                	break;
-
-                default:
-                    step = -1;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "keyedit.remove.uid.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "keyedit.save.okay")) {
-            response = (char *) "Y";
-            step = 0;
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
-    }
+    return state->command->genuid_name.c_str();
+}
 
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
-    }
-    return 0;
+inline const char *
+edit_respond_uid_email (edit_state *state, gpgme_error_t *error)
+{
+    if (state->command->genuid_email.length() > 1)
+        return state->command->genuid_email.c_str();
+    return "";
 }
 
-gpgme_error_t
-edit_fnc_set_primary_uid (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+inline const char *
+edit_respond_uid_comment (edit_state *state, gpgme_error_t *error)
 {
-  /* this sets a given UID as the primary for the key
-        the string current_uid must be populated before calling this method */
-
-    char *response = NULL;
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    response = (char *) current_uid.c_str();
-                    break;
-
-                case 1:
-                	response = (char *) "primary";
-                	break;
-
-                default:
-                    step = -1;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "keyedit.remove.uid.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "keyedit.save.okay")) {
-            response = (char *) "Y";
-            step = 0;
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
-    }
+    if (state->command->genuid_comment.length() > 1)
+        return state->command->genuid_comment.c_str();
+    return "";
+}
 
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
-    }
-    return 0;
+inline const char *
+edit_respond_subkey_algo (edit_state *state, gpgme_error_t *error)
+{
+    return state->command->gen_subkey_type.c_str();
 }
 
-gpgme_error_t
-edit_fnc_set_key_expire (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+inline const char *
+edit_respond_subkey_flags (edit_state *state, gpgme_error_t *error)
 {
-  /* this sets the expiration for a given key
-        the strings key_index and expiration must be populated before calling this method */
-
-    char *response = NULL;
-    std::string cmd;
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    cmd = "key ";
-                    cmd += key_index;
-                    response = (char *) cmd.c_str();
-                    break;
-
-                case 1:
-                	response = (char *) "expire";
-                	break;
-
-                default:
-                    step = -1;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "keygen.valid")) {
-            response = (char *) expiration.c_str();
-        } else if (!strcmp (args, "keyedit.save.okay")) {
-            response = (char *) "Y";
-            step = 0;
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
+    const edit_command *command = state->command;
+    const char *response;
+
+    switch (state->flag_step) {
+        case 0:
+            // If the gen_sign_flag is set, we don't need to change
+            //  anything, as the sign_flag is set by default
+            response = command->gen_sign_flag ? "nochange" : "S";
+            break;
+
+        case 1:
+            // If the gen_enc_flag is set, we don't need to change
+            //  anything, as the enc_flag is set by default on keys
+            //  that support the enc flag (RSA)
+            response = command->gen_enc_flag ? "nochange" : "E";
+            break;
+
+        case 2:
+            response = command->gen_auth_flag ? "A" : "nochange";
+            break;
+
+        default:
+            state->flag_step = -1;
+            response = "Q";
+            break;
     }
+    state->flag_step++;
+    return response;
+}
 
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
-    }
-    return 0;
+inline const char *
+edit_respond_subkey_size (edit_state *state, gpgme_error_t *error)
+{
+    return state->command->gen_subkey_length.c_str();
 }
 
-gpgme_error_t
-edit_fnc_revoke_item (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+inline const char *
+edit_respond_expiration (edit_state *state, gpgme_error_t *error)
 {
-  /* this revokes a given key, subkey or uid
-        the global strings revitem, key_index, reason_index and desc_text must be populated
-        before calling this method */
-
-    char *response = NULL;
-    std::string cmd;
-
-    if (!strcmp (revitem.c_str(), "revkey")) {
-            cmd = "key ";
-            cmd += key_index;
-    } else if (!strcmp (revitem.c_str(), "revuid")) {
-            cmd = "uid ";
-            cmd += current_uid;
-    } else if (!strcmp (revitem.c_str(), "revsig")) {
-            cmd = "uid ";
-            cmd += current_uid;
-    }
+    return state->command->expiration.c_str();
+}
 
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    response = (char *) cmd.c_str();
-                    break;
-
-                case 1:
-                    signature_iter = 0;
-                    text_line = 1;
-                	response = (char *) revitem.c_str();
-                	break;
-
-                default:
-                    step = -1;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "keyedit.revoke.subkey.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "ask_revoke_sig.one")) {
-            if (signature_iter == atoi(current_sig.c_str())) {
-                response = (char *) "Y";
-                current_sig = "0";
-                current_uid = "0";
-                signature_iter = 0;
-            } else {
-                response = (char *) "N";
-            }
-            signature_iter++;
-        } else if (!strcmp (args, "keyedit.revoke.uid.okay")){
-            response = (char *) "Y";
-        } else if (!strcmp (args, "ask_revoke_sig.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "ask_revocation_reason.code")) {
-            response = (char *) reason_index.c_str();
-        } else if (!strcmp (args, "ask_revocation_reason.text")) {
-            if (text_line > 1) {
-                text_line = 1;
-                response = (char *) "";
-            } else {
-                text_line++;
-                response = (char *) description.c_str();
-            }
-        } else if (!strcmp (args, "ask_revocation_reason.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "keyedit.save.okay")) {
-            response = (char *) "Y";
-            step = 0;
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
-    }
+inline const char *
+edit_respond_reason_code (edit_state *state, gpgme_error_t *error)
+{
+    return state->command->reason_index.c_str();
+}
 
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
+inline const char *
+edit_respond_reason_text (edit_state *state, gpgme_error_t *error)
+{
+    // The description is given as a single line, followed by an empty
+    //  line to end the text
+    if (state->text_line > 1) {
+        state->text_line = 1;
+        return "";
     }
-    return 0;
+    state->text_line++;
+    return state->command->description.c_str();
 }
 
-gpgme_error_t
-edit_fnc_add_subkey (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+/* An entry of the prompt table: a fixed response, or a generator for
+    responses that depend on the command */
+struct edit_prompt {
+    const char *name;
+    const char *response;
+    edit_responder respond;
+};
+
+/* The responses shared by all edit operations, indexed by edit_prompt_id.
+    To test the prompts and their output, you can execute GnuPG this way:
+        gpg --command-fd 0 --status-fd 2 --edit-key <KEY ID> */
+static const edit_prompt edit_prompts[EDIT_PROMPT_COUNT] = {
+    { NULL, NULL, NULL },
+    { "keyedit.prompt", NULL, edit_respond_command },
+    { "keyedit.save.okay", "Y", NULL },
+    { "passphrase.enter", NULL, edit_respond_passphrase },
+    { "sign_uid.okay", "y", NULL },
+    { "trustsig_prompt.trust_value", "1", NULL },
+    { "trustsig_prompt.trust_depth", "1", NULL },
+    { "trustsig_prompt.trust_regexp", "", NULL },
+    { "keyedit.delsig.valid", NULL, edit_respond_delsig },
+    { "keyedit.delsig.invalid", NULL, edit_respond_delsig },
+    { "keyedit.delsig.unknown", NULL, edit_respond_delsig },
+    { "keyedit.delsig.selfsig", "y", NULL },
+    { "edit_ownertrust.value", NULL, edit_respond_ownertrust },
+    { "edit_ownertrust.set_ultimate.okay", "Y", NULL },
+    { "keygen.name", NULL, edit_respond_uid_name },
+    { "keygen.email", NULL, edit_respond_uid_email },
+    { "keygen.comment", NULL, edit_respond_uid_comment },
+    { "keygen.algo", NULL, edit_respond_subkey_algo },
+    { "keygen.flags", NULL, edit_respond_subkey_flags },
+    { "keygen.size", NULL, edit_respond_subkey_size },
+    { "keygen.valid", NULL, edit_respond_expiration },
+    { "keyedit.remove.uid.okay", "Y", NULL },
+    { "keyedit.remove.subkey.okay", "Y", NULL },
+    { "keyedit.revoke.subkey.okay", "Y", NULL },
+    { "keyedit.revoke.uid.okay", "Y", NULL },
+    { "ask_revoke_sig.one", NULL, edit_respond_revsig },
+    { "ask_revoke_sig.okay", "Y", NULL },
+    { "ask_revocation_reason.code", NULL, edit_respond_reason_code },
+    { "ask_revocation_reason.text", NULL, edit_respond_reason_text },
+    { "ask_revocation_reason.okay", "Y", NULL },
+};
+
+#define EDIT_PROMPT_SLOTS 128
+
+inline unsigned int
+edit_prompt_hash (const char *s)
 {
-  /* this works for adding subkeys */
-    char *response = NULL;
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    response = (char *) "addkey";
-                    break;
-
-                default:
-                    response = (char *) "quit";
-                    step = -1;
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "keygen.algo")) {
-            response = (char *) gen_subkey_type.c_str();
-        } else if (!strcmp (args, "keygen.flags")) {
-            static int flag_step = 0;
-
-            switch (flag_step) {
-                case 0:
-                    // If the gen_sign_flag is set, we don't need to change
-                    //  anything, as the sign_flag is set by default
-                    if (gen_sign_flag) {
-                        response = (char *) "nochange";
-                    } else {
-                        response = (char *) "S";
-                    }
-                    break;
-
-                case 1:
-                    // If the gen_enc_flag is set, we don't need to change
-                    //  anything, as the enc_flag is set by default on keys
-                    //  that support the enc flag (RSA)
-                    if (gen_enc_flag) {
-                        response = (char *) "nochange";
-                    } else {
-                        response = (char *) "E";
-                    }
-                    break;
-
-                case 2:
-                    if (gen_auth_flag) {
-                        response = (char *) "A";
-                    } else {
-                        response = (char *) "nochange";
-                    }
-                    break;
-
-                default:
-                    response = (char *) "Q";
-                    flag_step = -1;
-                    break;
-
-            }
-            flag_step++;
-        } else if (!strcmp (args, "keygen.size")) {
-            response = (char *) gen_subkey_length.c_str();
-        } else if (!strcmp (args, "keygen.valid")) {
-            response = (char *) gen_subkey_expire.c_str();
-        } else if (!strcmp (args, "keyedit.save.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
+    // FNV-1a
+    unsigned int h = 2166136261u;
+    while (*s)
+        h = (h ^ (unsigned char) *s++) * 16777619u;
+    return h;
+}
+
+/* An open addressed hash index over the names in edit_prompts. It is
+    filled once while the plugin loads; as it is never more than a quarter
+    full a lookup takes one hash and, for a known prompt, about one string
+    comparison. */
+struct edit_prompt_index {
+    edit_prompt_index()
+    {
+        memset (slots, 0, sizeof(slots));
+        for (int id = 1; id < EDIT_PROMPT_COUNT; id++) {
+            unsigned int h = edit_prompt_hash (edit_prompts[id].name);
+            while (slots[h % EDIT_PROMPT_SLOTS])
+                h++;
+            slots[h % EDIT_PROMPT_SLOTS] = (unsigned char) id;
         }
     }
 
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
+    edit_prompt_id find (const char *args) const
+    {
+        unsigned int h = edit_prompt_hash (args);
+        while (slots[h % EDIT_PROMPT_SLOTS]) {
+            unsigned char id = slots[h % EDIT_PROMPT_SLOTS];
+            if (!strcmp (edit_prompts[id].name, args))
+                return (edit_prompt_id) id;
+            h++;
+        }
+        return EDIT_PROMPT_UNKNOWN;
     }
-    return 0;
-}
 
-gpgme_error_t
-edit_fnc_delete_subkey (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+    unsigned char slots[EDIT_PROMPT_SLOTS];
+};
+
+static const edit_prompt_index edit_prompt_ids;
+
+inline const char *
+edit_prompt_name (edit_prompt_id id)
 {
-  /* this works for deleting subkeys */
-    char *response = NULL;
-    std::string cmd;
-    cmd = "key ";
-    cmd += key_index;
-    response = (char *) cmd.c_str();
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    cmd = "key ";
-                    cmd += key_index;
-                    response = (char *) cmd.c_str();
-                    break;
-
-                case 1:
-                    signature_iter = 1;
-                    response = (char *) "delkey";
-                    break;
-
-                default:
-                    step = -1;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "keyedit.save.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "keyedit.remove.subkey.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
-    }
+    return id == EDIT_PROMPT_UNKNOWN ? "" : edit_prompts[id].name;
+}
 
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
-    }
-    return 0;
+inline edit_prompt_id
+edit_prompt_lookup (const char *args)
+{
+    return edit_prompt_ids.find (args);
 }
 
 gpgme_error_t
-edit_fnc_change_passphrase (void *opaque, gpgme_status_code_t status, const char *args, int fd)
+edit_fnc (void *opaque, gpgme_status_code_t status, const char *args, int fd)
 {
-  /* this invokes a passphrase change. all I/O of passphrases should happen with the agent  */
-    char *response = NULL;
-
-    if (fd >= 0) {
-        if (!strcmp (args, "keyedit.prompt")) {
-            static int step = 0;
-
-            switch (step) {
-                case 0:
-                    response = (char *) "passwd";
-                    break;
-
-                default:
-                    step = -1;
-                    response = (char *) "quit";
-                    break;
-            }
-            step++;
-        } else if (!strcmp (args, "keyedit.save.okay")) {
-            response = (char *) "Y";
-        } else if (!strcmp (args, "passphrase.enter")) {
-            response = (char *) "";
-        } else {
-        	fprintf (stdout, "We shouldn't reach this line actually; Line: %i\n", __LINE__);
-        	edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": we should never reach here;";
-        	return 1;
-        }
-    }
+  /* this runs the commands of the edit_state passed as opaque and then
+        saves; the commands vector must be populated before calling this
+        method (see edit_add_command) */
+    edit_state *state = (edit_state *) opaque;
+    gpgme_error_t error = GPG_ERR_NO_ERROR;
+    const char *response;
 
-    if (response) {
-        edit_status = edit_status + " " + args + ", case " + i_to_str(step) + ": response: " + response + ";";
-#ifdef HAVE_W32_SYSTEM
-        DWORD written;
-        WriteFile ((HANDLE) fd, response, strlen (response), &written, 0);
-        WriteFile ((HANDLE) fd, "\n", 1, &written, 0);
-#else
-        ssize_t write_result;
-        write_result = write (fd, response, strlen (response));
-        write_result = write (fd, "\n", 1);
-#endif
-    }
-    return 0;
+    if (status != GPGME_STATUS_GET_LINE && status != GPGME_STATUS_GOT_IT)
+        state->status_result = status;
+
+    if (fd < 0)
+        return 0;
+
+    edit_prompt_id id = edit_prompt_lookup (args);
+    if (id == EDIT_PROMPT_UNKNOWN
+        || (id != EDIT_PROMPT_KEYEDIT && !state->command))
+        return edit_unexpected (state, args, __LINE__);
+
+    const edit_prompt& prompt = edit_prompts[id];
+    response = prompt.respond ? prompt.respond (state, &error) : prompt.response;
+
+    state->prior_response = response;
+    edit_respond (state, id, response, fd);
+    return error;
 }
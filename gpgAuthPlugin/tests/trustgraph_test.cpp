@@ -0,0 +1,284 @@
+/**********************************************************\
+Original Author: Kyle L. Huff (kylehuff)
+
+Created:    Jan 14, 2011
+License:    GNU General Public License, version 2
+            http://www.gnu.org/licenses/gpl-2.0.html
+
+Copyright 2011 Kyle L. Huff, CURETHEITCH development team
+\**********************************************************/
+
+/*
+ * A standalone check that the graph based evaluation of verifyDomainKey()
+ *  (trust_graph_evaluate_domain_key(), memoized the way
+ *  gpgAuthPluginAPI::evaluateDomainKey() does it) returns the same result
+ *  as the gpg based reference, trust_graph_domain_key_validity_gpg().
+ *
+ * The fixture keyrings are created with gpg 2 in a temporary home directory
+ *  and cover signatures by ultimately, fully and marginally trusted keys, a
+ *  key without its secret part, an expired key and a disabled key, as well
+ *  as an expired and a revoked signature, a disabled domain key, a revoked
+ *  UID and a UID other than the first.
+ *
+ * Build and run from this directory (Linux x86_64):
+ *
+ *  g++ -I.. -I../libs/libgpgme/Linux_x86-gcc -I../libs/libgpg-error/Linux_x86-gcc \
+ *      trustgraph_test.cpp ../libs/libgpgme/Linux_x86_64-gcc/libgpgme.a \
+ *      ../libs/libassuan/Linux_x86_64-gcc/libassuan.a \
+ *      ../libs/libgpg-error/Linux_x86_64-gcc/libgpg-error.a -o trustgraph_test
+ *  ./trustgraph_test
+ *
+ * The exit status is 0 if every case matches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <locale.h>
+#include <set>
+#include <sstream>
+#include "gpgme.h"
+#include "trustgraph.h"
+#include "cache.h"
+
+static std::string gpg_home;
+
+/* Runs gpg on the fixture home directory; returns its exit status */
+static int run_gpg(const std::string& args, const char *faked_time=NULL)
+{
+    std::string cmd = "gpg --homedir '" + gpg_home + "' --batch --yes"
+        " --pinentry-mode loopback --passphrase ''";
+    if (faked_time)
+        cmd += std::string(" --faked-system-time ") + faked_time;
+    cmd += " " + args + " >/dev/null 2>&1";
+    return system(cmd.c_str());
+}
+
+/* Creates a key with the user id uid and returns its fingerprint */
+static std::string gen_key(const std::string& uid, const char *expire="never",
+    const char *faked_time=NULL)
+{
+    std::string fpr;
+    char line[1024];
+
+    std::string cmd = "gpg --homedir '" + gpg_home + "' --batch --yes"
+        " --pinentry-mode loopback --passphrase '' --status-fd 1";
+    if (faked_time)
+        cmd += std::string(" --faked-system-time ") + faked_time;
+    cmd += " --quick-gen-key '" + uid + "' rsa1024 cert,sign " + expire + " 2>/dev/null";
+
+    FILE *out = popen(cmd.c_str(), "r");
+    if (!out)
+        return "";
+    while (fgets(line, sizeof(line), out)) {
+        // [GNUPG:] KEY_CREATED P <fingerprint>
+        if (!strncmp(line, "[GNUPG:] KEY_CREATED ", 21) && strlen(line) >= 64)
+            fpr = std::string(line + 23, 40);
+    }
+    pclose(out);
+    return fpr;
+}
+
+static void set_ownertrust(const std::string& fpr, int value)
+{
+    std::ostringstream cmd;
+    cmd << "sh -c \"echo " << fpr << ":" << value << ": | gpg --homedir '"
+        << gpg_home << "' --batch --import-ownertrust\" >/dev/null 2>&1";
+    system(cmd.str().c_str());
+}
+
+static gpgme_ctx_t new_ctx()
+{
+    gpgme_ctx_t ctx;
+    if (gpgme_new (&ctx) != GPG_ERR_NO_ERROR)
+        return NULL;
+    gpgme_set_protocol (ctx, GPGME_PROTOCOL_OpenPGP);
+    return ctx;
+}
+
+int main()
+{
+    char home_template[] = "/tmp/trustgraph_test.XXXXXX";
+    int mismatches = 0, cases = 0;
+    std::set<int> seen;
+    size_t d, s;
+    long uid_idx;
+
+    if (!mkdtemp(home_template)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    gpg_home = home_template;
+    setenv("GNUPGHOME", gpg_home.c_str(), 1);
+
+    setlocale (LC_ALL, "");
+    gpgme_check_version (NULL);
+    gpgme_set_locale (NULL, LC_CTYPE, setlocale (LC_CTYPE, NULL));
+
+    // The signing keys; a generated key has ultimate ownertrust
+    std::string user = gen_key("User <user@example.org>");
+    std::string full = gen_key("Full <full@example.org>");
+    std::string pub = gen_key("Public <public@example.org>");
+    std::string marginal = gen_key("Marginal <marginal@example.org>");
+    std::string expired = gen_key("Expired <expired@example.org>", "1d",
+        "20200101T000000");
+    std::string old = gen_key("Old <old@example.org>", "never", "20200101T000000");
+    std::string disabled = gen_key("Disabled <disabled@example.org>");
+    set_ownertrust(full, 5);
+    set_ownertrust(pub, 5);
+    set_ownertrust(marginal, 4);
+
+    if (user.empty() || full.empty() || pub.empty() || marginal.empty()
+        || expired.empty() || old.empty() || disabled.empty()) {
+        fprintf(stderr, "unable to create the fixture keys in %s\n", gpg_home.c_str());
+        return 1;
+    }
+
+    // The domain keys, each with the certifications of one case
+    std::vector<std::string> domain_keys;
+    std::string key;
+
+    key = gen_key("example.com");
+    run_gpg("-u " + user + " --quick-sign-key " + key);
+    domain_keys.push_back(key);
+
+    key = gen_key("example.com");
+    run_gpg("-u " + full + " --quick-sign-key " + key);
+    domain_keys.push_back(key);
+
+    key = gen_key("example.com");
+    run_gpg("-u " + pub + " --quick-sign-key " + key);
+    domain_keys.push_back(key);
+
+    key = gen_key("example.com");
+    run_gpg("-u " + marginal + " --quick-sign-key " + key);
+    domain_keys.push_back(key);
+
+    // Certified while the signing key was valid
+    key = gen_key("example.com", "never", "20200101T000000");
+    run_gpg("-u " + expired + " --quick-sign-key " + key, "20200101T120000");
+    domain_keys.push_back(key);
+
+    // A certification that expired
+    key = gen_key("example.com", "never", "20200101T000000");
+    run_gpg("-u " + old + " --default-cert-expire 1d --quick-sign-key " + key,
+        "20200101T120000");
+    domain_keys.push_back(key);
+
+    key = gen_key("example.com");
+    run_gpg("-u " + user + " --quick-sign-key " + key);
+    run_gpg("--edit-key " + key + " disable quit");
+    domain_keys.push_back(key);
+
+    key = gen_key("example.com");
+    run_gpg("-u " + disabled + " --quick-sign-key " + key);
+    domain_keys.push_back(key);
+
+    key = gen_key("example.com");
+    run_gpg("-u " + user + " --quick-sign-key " + key);
+    run_gpg("--quick-revoke-sig " + key + " " + user);
+    domain_keys.push_back(key);
+
+    key = gen_key("example.com");
+    run_gpg("--quick-add-uid " + key + " www.example.com");
+    run_gpg("-u " + user + " --quick-sign-key " + key);
+    run_gpg("--quick-revoke-uid " + key + " example.com");
+    domain_keys.push_back(key);
+
+    // The domain is the second UID; only the first is signed by user
+    key = gen_key("other.org");
+    run_gpg("--quick-add-uid " + key + " example.com");
+    run_gpg("-u " + user + " --quick-sign-key " + key + " other.org");
+    run_gpg("-u " + full + " --quick-sign-key " + key + " example.com");
+    domain_keys.push_back(key);
+
+    key = gen_key("example.com");
+    domain_keys.push_back(key);
+
+    // pub signs as long as its secret key is there
+    run_gpg("--delete-secret-keys " + pub);
+    run_gpg("--edit-key " + disabled + " disable quit");
+
+    for (d = 0; d < domain_keys.size(); d++) {
+        if (domain_keys[d].empty()) {
+            fprintf(stderr, "unable to create the fixture keys in %s\n", gpg_home.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<std::string> signers;
+    signers.push_back(user);
+    signers.push_back(full);
+    signers.push_back(pub);
+    signers.push_back(marginal);
+    signers.push_back(expired);
+    signers.push_back(old);
+    signers.push_back(disabled);
+    signers.push_back("0123456789ABCDEF");
+
+    gpgme_ctx_t ctx = new_ctx();
+    trust_graph graph;
+    graph.generation = 1;
+    if (!ctx || trust_graph_build(ctx, graph) != GPG_ERR_NO_ERROR) {
+        fprintf(stderr, "unable to build the signature graph\n");
+        return 1;
+    }
+    gpgme_release (ctx);
+
+    // Evaluated as in gpgAuthPluginAPI::evaluateDomainKey(); the memo holds
+    //  every case, so the second pass must be answered from it
+    lru_cache<int> memo(domain_keys.size() * signers.size() * 4);
+    std::vector<int> references;
+
+    for (int pass = 0; pass < 2; pass++) {
+        size_t n = 0;
+        for (d = 0; d < domain_keys.size(); d++) {
+            for (s = 0; s < signers.size(); s++) {
+                std::string required = signers[s].length() == 40 ?
+                    signers[s].substr(24) : signers[s];
+                for (uid_idx = -1; uid_idx < 3; uid_idx++, n++) {
+                    std::ostringstream memo_key;
+                    int result;
+                    bool memoized;
+
+                    memo_key << "example.com\n" << domain_keys[d] << "\n"
+                        << uid_idx << "\n" << required;
+
+                    if (pass == 0) {
+                        ctx = new_ctx();
+                        references.push_back(trust_graph_domain_key_validity_gpg(ctx,
+                            "example.com", domain_keys[d], uid_idx, required));
+                        gpgme_release (ctx);
+                        seen.insert(references[n]);
+                    }
+
+                    memoized = memo.get(memo_key.str(), "1", result);
+                    if (!memoized) {
+                        if (!trust_graph_evaluate_domain_key(graph, "example.com",
+                            domain_keys[d], uid_idx, required, result))
+                            result = -100;
+                        memo.put(memo_key.str(), "1", graph.expires, result);
+                    }
+
+                    cases++;
+                    if (result != references[n] || memoized != (pass == 1)) {
+                        mismatches++;
+                        printf("MISMATCH key %s signer %s uid %ld: gpg %d, graph %d%s\n",
+                            domain_keys[d].c_str(), required.c_str(), uid_idx,
+                            references[n], result, memoized ? " (memoized)" : "");
+                    }
+                }
+            }
+        }
+    }
+
+    printf("%d cases, %d mismatches, results:", cases, mismatches);
+    for (std::set<int>::iterator it = seen.begin(); it != seen.end(); it++)
+        printf(" %d", *it);
+    printf("\n");
+
+    system(("gpgconf --homedir '" + gpg_home + "' --kill gpg-agent >/dev/null 2>&1").c_str());
+    system(("rm -rf '" + gpg_home + "'").c_str());
+
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,780 @@
+/**********************************************************\
+Original Author: Kyle L. Huff (kylehuff)
+
+Created:    Jan 14, 2011
+License:    GNU General Public License, version 2
+            http://www.gnu.org/licenses/gpl-2.0.html
+
+Copyright 2011 Kyle L. Huff, CURETHEITCH development team
+\**********************************************************/
+
+/*
+ * An in-memory graph of the keys in the keyring and the certifications
+ *  between them.
+ *
+ * The graph is built from a single listing of every public key with its
+ *  signatures and a single listing of the secret keys, after which trust
+ *  questions (i.e. gpgAuthPluginAPI::verifyDomainKey()) are answered from
+ *  lookups in the graph instead of a gpg invocation per key.
+ *
+ * This file must be included after gpgme.h.
+ */
+
+#include <time.h>
+#include <ctype.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#ifndef H_gpgAuthPluginTRUSTGRAPH
+#define H_gpgAuthPluginTRUSTGRAPH
+
+// Results of trust_graph_find() other than an index into trust_graph::keys
+#define TRUST_GRAPH_NOT_FOUND -1
+#define TRUST_GRAPH_AMBIGUOUS -2
+// The pattern is not a key id or fingerprint and must be resolved by gpg
+#define TRUST_GRAPH_UNSUPPORTED -3
+
+// A certification on a UID; an edge from the signing key to the UID
+struct trust_sig {
+    // 16 character, uppercase key id of the signing key
+    std::string keyid;
+    // The index of the signing key in trust_graph::keys, or one of the
+    //  TRUST_GRAPH_ values if the key is missing or its id is ambiguous
+    long signer;
+    gpgme_error_t status;
+    bool revoked;
+    bool expired;
+    bool invalid;
+    long expires;
+};
+
+struct trust_uid {
+    std::string name;
+    bool revoked;
+    bool invalid;
+    std::vector<trust_sig> sigs;
+};
+
+struct trust_key {
+    std::string fpr;
+    std::string keyid;
+    gpgme_validity_t owner_trust;
+    bool revoked;
+    bool expired;
+    bool disabled;
+    bool invalid;
+    // A secret key with the same fingerprint is in the keyring
+    bool secret;
+    std::vector<trust_uid> uids;
+    // The indexes of the keys with a valid certification by this key, and
+    //  of the keys with a valid certification on this key
+    std::vector<long> certifies;
+    std::vector<long> certified_by;
+};
+
+struct trust_graph {
+    std::vector<trust_key> keys;
+    // The fingerprint, key id and short key id of every subkey, mapped to
+    //  the index of its key or TRUST_GRAPH_AMBIGUOUS
+    std::map<std::string, long> index;
+    // The keyring stamp the graph was built under
+    std::string stamp;
+    // Distinguishes graphs built under the same stamp
+    unsigned long generation;
+    // The earliest key or signature expiration still in the future when the
+    //  graph was built (0 if there is none); the expired flags are stale
+    //  after it
+    time_t expires;
+    // trust_graph_validity() results by "completes:marginals:depth"; entries
+    //  are never changed or removed once stored, the owner of the graph
+    //  serializes access to the map
+    std::map<std::string, std::vector<gpgme_validity_t> > validity_memo;
+};
+
+inline void trust_graph_index_add(trust_graph& graph, const char *id, long key_idx)
+{
+    if (!id)
+        return;
+
+    std::map<std::string, long>::iterator it = graph.index.find(id);
+    if (it == graph.index.end())
+        graph.index[id] = key_idx;
+    else if (it->second != key_idx)
+        it->second = TRUST_GRAPH_AMBIGUOUS;
+}
+
+inline void trust_graph_note_expiry(trust_graph& graph, long expires, time_t now)
+{
+    if (expires > now && (!graph.expires || expires < graph.expires))
+        graph.expires = expires;
+}
+
+// A certification that can carry trust: the UID and the signature are intact
+//  and it was made by another key
+inline bool trust_sig_usable(const trust_uid& uid, const trust_sig& sig, long key_idx)
+{
+    return sig.signer >= 0 && sig.signer != key_idx && sig.status == GPG_ERR_NO_ERROR
+        && !sig.revoked && !sig.expired && !sig.invalid
+        && !uid.revoked && !uid.invalid;
+}
+
+inline void trust_graph_unique(std::vector<long>& v)
+{
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+// Returns the index of the key matching pattern, which may be a key id,
+//  short key id or fingerprint of any of the subkeys of the key, or one of
+//  the TRUST_GRAPH_ values
+inline long trust_graph_find(const trust_graph& graph, const std::string& pattern)
+{
+    std::string id = pattern;
+    size_t i;
+
+    if (id.length() > 2 && id[0] == '0' && (id[1] == 'x' || id[1] == 'X'))
+        id = id.substr(2);
+
+    if (id.length() != 8 && id.length() != 16 && id.length() != 40)
+        return TRUST_GRAPH_UNSUPPORTED;
+
+    for (i = 0; i < id.length(); i++) {
+        if (!isxdigit((unsigned char) id[i]))
+            return TRUST_GRAPH_UNSUPPORTED;
+        id[i] = toupper((unsigned char) id[i]);
+    }
+
+    std::map<std::string, long>::const_iterator it = graph.index.find(id);
+    if (it == graph.index.end())
+        return TRUST_GRAPH_NOT_FOUND;
+
+    return it->second;
+}
+
+// Populates graph from the keyring of ctx; ctx must be idle and its
+//  keylist mode is changed to include signatures
+inline gpgme_error_t trust_graph_build(gpgme_ctx_t ctx, trust_graph& graph)
+{
+    gpgme_error_t err;
+    gpgme_key_t key;
+    gpgme_subkey_t subkey;
+    gpgme_user_id_t uid;
+    gpgme_key_sig_t sig;
+    std::map<std::string, long> fprs;
+    time_t now = time(NULL);
+    size_t i, j, k;
+
+    graph.keys.clear();
+    graph.index.clear();
+    graph.expires = 0;
+
+    gpgme_set_keylist_mode (ctx, (gpgme_get_keylist_mode (ctx)
+                                | GPGME_KEYLIST_MODE_SIGS));
+
+    err = gpgme_op_keylist_start (ctx, NULL, 0);
+    if (err != GPG_ERR_NO_ERROR)
+        return err;
+
+    while (!(err = gpgme_op_keylist_next (ctx, &key))) {
+        trust_key node;
+        long key_idx = graph.keys.size();
+
+        if (!key->subkeys || !key->subkeys->fpr) {
+            gpgme_key_unref (key);
+            continue;
+        }
+
+        node.fpr = key->subkeys->fpr;
+        node.keyid = key->subkeys->keyid ? key->subkeys->keyid : "";
+        node.owner_trust = key->owner_trust;
+        node.revoked = key->revoked;
+        node.expired = key->expired;
+        node.disabled = key->disabled;
+        node.invalid = key->invalid;
+        node.secret = false;
+
+        for (subkey = key->subkeys; subkey; subkey = subkey->next) {
+            trust_graph_index_add(graph, subkey->fpr, key_idx);
+            trust_graph_index_add(graph, subkey->keyid, key_idx);
+            if (subkey->keyid && strlen(subkey->keyid) == 16)
+                trust_graph_index_add(graph, subkey->keyid + 8, key_idx);
+            trust_graph_note_expiry(graph, subkey->expires, now);
+        }
+
+        for (uid = key->uids; uid; uid = uid->next) {
+            trust_uid uid_node;
+            uid_node.name = uid->name ? uid->name : "";
+            uid_node.revoked = uid->revoked;
+            uid_node.invalid = uid->invalid;
+
+            for (sig = uid->signatures; sig; sig = sig->next) {
+                trust_sig edge;
+                edge.keyid = sig->keyid ? sig->keyid : "";
+                edge.signer = TRUST_GRAPH_NOT_FOUND;
+                edge.status = sig->status;
+                edge.revoked = sig->revoked;
+                edge.expired = sig->expired;
+                edge.invalid = sig->invalid;
+                edge.expires = sig->expires;
+                trust_graph_note_expiry(graph, sig->expires, now);
+                uid_node.sigs.push_back(edge);
+            }
+            node.uids.push_back(uid_node);
+        }
+
+        fprs[node.fpr] = key_idx;
+        graph.keys.push_back(node);
+        gpgme_key_unref (key);
+    }
+
+    if (gpg_err_code (err) != GPG_ERR_EOF)
+        return err;
+
+    err = gpgme_op_keylist_end (ctx);
+    if (err != GPG_ERR_NO_ERROR)
+        return err;
+
+    // Resolve the signer of every certification and link the keys
+    for (i = 0; i < graph.keys.size(); i++) {
+        for (j = 0; j < graph.keys[i].uids.size(); j++) {
+            std::vector<trust_sig>& sigs = graph.keys[i].uids[j].sigs;
+            for (k = 0; k < sigs.size(); k++) {
+                std::map<std::string, long>::const_iterator it =
+                    graph.index.find(sigs[k].keyid);
+                if (it != graph.index.end())
+                    sigs[k].signer = it->second;
+                if (trust_sig_usable(graph.keys[i].uids[j], sigs[k], i)) {
+                    graph.keys[i].certified_by.push_back(sigs[k].signer);
+                    graph.keys[sigs[k].signer].certifies.push_back(i);
+                }
+            }
+        }
+    }
+    for (i = 0; i < graph.keys.size(); i++) {
+        trust_graph_unique(graph.keys[i].certifies);
+        trust_graph_unique(graph.keys[i].certified_by);
+    }
+
+    err = gpgme_op_keylist_start (ctx, NULL, 1);
+    if (err != GPG_ERR_NO_ERROR)
+        return err;
+
+    while (!(err = gpgme_op_keylist_next (ctx, &key))) {
+        if (key->subkeys && key->subkeys->fpr) {
+            std::map<std::string, long>::iterator it = fprs.find(key->subkeys->fpr);
+            if (it != fprs.end())
+                graph.keys[it->second].secret = true;
+        }
+        gpgme_key_unref (key);
+    }
+
+    if (gpg_err_code (err) != GPG_ERR_EOF)
+        return err;
+
+    return gpgme_op_keylist_end (ctx);
+}
+
+/*
+    Evaluates the trust of the UID <domain> on the key at domain_idx as
+        signed by the key at user_idx (found with required_sig_keyid).
+
+    This follows the gpg based evaluation in
+        trust_graph_domain_key_validity_gpg() step for step, including the
+        cases in which that function gives up with -1 because gpgme_get_key
+        failed, so that both return the same value for the same keyring;
+        tests/trustgraph_test.cpp compares the two.
+*/
+inline int trust_graph_domain_key_validity(const trust_graph& graph,
+    const std::string& domain, long domain_idx, long uid_idx,
+    const std::string& required_sig_keyid, long user_idx)
+{
+    const trust_key& domain_key = graph.keys[domain_idx];
+    const trust_key& user_key = graph.keys[user_idx];
+    int domain_key_valid = -1;
+    size_t nuids, nsigs;
+
+    for (nuids = 0; nuids < domain_key.uids.size(); nuids++) {
+        const trust_uid& uid = domain_key.uids[nuids];
+        for (nsigs = 0; nsigs < uid.sigs.size(); nsigs++) {
+            const trust_sig& sig = uid.sigs[nsigs];
+            if (domain_key.disabled) {
+                domain_key_valid = -2;
+                break;
+            }
+            if (uid.name == domain && (uid_idx == (long) nuids || uid_idx == -1)) {
+                if (uid.revoked)
+                    domain_key_valid = -3;
+                if (sig.keyid == required_sig_keyid) {
+                    if (user_key.owner_trust == GPGME_VALIDITY_ULTIMATE)
+                        domain_key_valid = 0;
+                    if (user_key.owner_trust == GPGME_VALIDITY_FULL)
+                        domain_key_valid = 2;
+                    if (user_key.expired)
+                        domain_key_valid++;
+                    if (sig.invalid || sig.revoked || sig.expired)
+                        domain_key_valid = -4;
+                    if (user_key.disabled)
+                        domain_key_valid = -5;
+                    if (sig.status == GPG_ERR_NO_PUBKEY
+                        || sig.status == GPG_ERR_GENERAL)
+                        domain_key_valid = -1;
+                    // the key trust is 0 (best), stop searching
+                    if (domain_key_valid == 0)
+                        break;
+                }
+            }
+        }
+    }
+
+    if (domain_key_valid != -1)
+        return domain_key_valid;
+
+    // the UID failed the signature test, check to see if the primary UID was
+    //  signed by one permissible key, or a trusted key.
+    for (nuids = 0; nuids < domain_key.uids.size(); nuids++) {
+        const trust_uid& uid = domain_key.uids[nuids];
+        for (nsigs = 0; nsigs < uid.sigs.size(); nsigs++) {
+            const trust_sig& sig = uid.sigs[nsigs];
+            if (sig.status != GPG_ERR_NO_ERROR)
+                continue;
+            if (uid_idx == (long) nuids && domain_key_valid == -1) {
+                // gpgme_get_key fails for a missing or ambiguous signer, and
+                //  for a signer without a secret key
+                if (sig.signer < 0 || !graph.keys[sig.signer].secret)
+                    return -1;
+
+                const trust_key& key = graph.keys[sig.signer];
+                if (key.owner_trust == GPGME_VALIDITY_ULTIMATE)
+                    domain_key_valid = 4;
+                if (key.owner_trust == GPGME_VALIDITY_FULL)
+                    domain_key_valid = 6;
+                if (key.expired && domain_key_valid < -1)
+                    domain_key_valid += -1;
+                if (key.expired && domain_key_valid >= 0)
+                    domain_key_valid++;
+                if (sig.expired)
+                    domain_key_valid = -6;
+                if (sig.invalid)
+                    domain_key_valid = -2;
+                if (uid.revoked || sig.revoked)
+                    domain_key_valid = -6;
+            }
+            if (sig.keyid == required_sig_keyid && nuids == 0) {
+                if (user_key.owner_trust == GPGME_VALIDITY_ULTIMATE)
+                    domain_key_valid = 4;
+                if (user_key.owner_trust == GPGME_VALIDITY_FULL)
+                    domain_key_valid = 6;
+                if (user_key.expired)
+                    domain_key_valid++;
+                if (sig.expired)
+                    domain_key_valid = -6;
+                if (sig.invalid)
+                    domain_key_valid = -2;
+                if (uid.revoked || sig.revoked)
+                    domain_key_valid = -6;
+            }
+        }
+    }
+
+    return domain_key_valid;
+}
+
+/*
+    Evaluates verifyDomainKey() for the keys given by domain_key_fpr and
+        required_sig_keyid, resolving them in graph the way gpgme_get_key
+        does. Returns false if a pattern cannot be resolved by the graph and
+        gpg has to be asked (see trust_graph_domain_key_validity_gpg()).
+*/
+inline bool trust_graph_evaluate_domain_key(const trust_graph& graph,
+    const std::string& domain, const std::string& domain_key_fpr, long uid_idx,
+    const std::string& required_sig_keyid, int& result)
+{
+    long user_idx = trust_graph_find(graph, required_sig_keyid);
+    long domain_idx = trust_graph_find(graph, domain_key_fpr);
+
+    // gpgme_get_key fails for a missing or ambiguous required key
+    if (user_idx == TRUST_GRAPH_NOT_FOUND || user_idx == TRUST_GRAPH_AMBIGUOUS)
+        result = -1;
+    else if (domain_idx == TRUST_GRAPH_NOT_FOUND)
+        result = -1;
+    else if (user_idx >= 0 && domain_idx >= 0)
+        result = trust_graph_domain_key_validity(graph, domain, domain_idx,
+            uid_idx, required_sig_keyid, user_idx);
+    else
+        return false;
+
+    return true;
+}
+
+/*
+    The reference evaluation of verifyDomainKey(), which queries gpg through
+        ctx for each of the keys involved instead of using a graph; the
+        result of trust_graph_evaluate_domain_key() must always match it.
+*/
+inline int trust_graph_domain_key_validity_gpg(gpgme_ctx_t ctx,
+    const std::string& domain, const std::string& domain_key_fpr,
+    long uid_idx, const std::string& required_sig_keyid)
+{
+    int nuids;
+    int nsigs;
+    int domain_key_valid = -1;
+    gpgme_key_t domain_key, user_key, secret_key, key;
+    gpgme_user_id_t uid;
+    gpgme_key_sig_t sig;
+    gpgme_error_t err;
+    gpgme_keylist_result_t result;
+    
+    gpgme_set_keylist_mode (ctx, (gpgme_get_keylist_mode (ctx) 
+                                | GPGME_KEYLIST_MODE_SIGS));
+
+    err = gpgme_op_keylist_start (ctx, (char *) domain_key_fpr.c_str(), 0);
+    if(err != GPG_ERR_NO_ERROR) return -1;
+
+    err = gpgme_get_key(ctx, (char *) required_sig_keyid.c_str(), &user_key, 0);
+    if(err != GPG_ERR_NO_ERROR) return -1;
+
+    if (user_key) {
+        while (!(err = gpgme_op_keylist_next (ctx, &domain_key))) {
+            for (nuids=0, uid=domain_key->uids; uid; uid = uid->next, nuids++) {
+                for (nsigs=0, sig=uid->signatures; sig; sig = sig->next, nsigs++) {
+                    if (domain_key->disabled) {
+                        domain_key_valid = -2;
+                        break;
+                    }
+                    if (!strcmp(uid->name, (char *) domain.c_str()) && (uid_idx == nuids || uid_idx == -1)) {
+                        if (uid->revoked)
+                            domain_key_valid = -3;
+                        if (!strcmp(sig->keyid, (char *) required_sig_keyid.c_str())){
+                            if (user_key->owner_trust == GPGME_VALIDITY_ULTIMATE)
+                                domain_key_valid = 0;
+                            if (user_key->owner_trust == GPGME_VALIDITY_FULL)
+                                domain_key_valid = 2;
+                            if (user_key->expired)
+                                domain_key_valid++;
+                            if (sig->invalid)
+                                domain_key_valid = -4;
+                            if (sig->revoked)
+                                domain_key_valid = -4;
+                            if (sig->expired)
+                                domain_key_valid = -4;
+                            if (user_key->disabled)
+                                domain_key_valid = -5;
+                            if (sig->status == GPG_ERR_NO_PUBKEY)
+                                domain_key_valid = -1;
+                            if (sig->status == GPG_ERR_GENERAL)
+                                domain_key_valid = -1;
+                            // the key trust is 0 (best), stop searching
+                            if (domain_key_valid == 0)
+                                break;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (gpg_err_code (err) != GPG_ERR_EOF) return -1;
+        gpgme_get_key(ctx, (char *) domain_key_fpr.c_str(), &domain_key, 0);
+        err = gpgme_op_keylist_end (ctx);
+        if(err != GPG_ERR_NO_ERROR) return -1;
+
+        result = gpgme_op_keylist_result (ctx);
+        // the UID failed the signature test, check to see if the primary UID was signed
+        // by one permissible key, or a trusted key.
+        if (domain_key_valid == -1) {
+            for (nuids=0, uid=domain_key->uids; uid; uid = uid->next, nuids++) {
+                for (nsigs=0, sig=uid->signatures; sig; sig=sig->next, nsigs++) {
+                    if (!sig->status == GPG_ERR_NO_ERROR)
+                        continue;
+                    // the signature keyid matches the required_sig_keyid
+                    if (nuids == uid_idx && domain_key_valid == -1){
+                        err = gpgme_get_key(ctx, (char *) sig->keyid, &key, 0);
+                        if(err != GPG_ERR_NO_ERROR) return -1;
+                        err = gpgme_get_key(ctx, (char *) sig->keyid, &secret_key, 1);
+                        if(err != GPG_ERR_NO_ERROR) return -1;
+
+                        if (key && key->owner_trust == GPGME_VALIDITY_ULTIMATE) {
+                            if (!secret_key) {
+                                domain_key_valid = 8;
+                            } else {
+                                domain_key_valid = 4;
+                            }
+                        }
+                        if (key && key->owner_trust == GPGME_VALIDITY_FULL) {
+                            if (!secret_key) {
+                                domain_key_valid = 8;
+                            } else {
+                                domain_key_valid = 6;
+                            }
+                        }
+                        if (key && key->expired && domain_key_valid < -1)
+                            domain_key_valid += -1;
+                        if (key && key->expired && domain_key_valid >= 0) {
+                            domain_key_valid++;
+                        }
+                        if (sig->expired)
+                            domain_key_valid = -6;
+                        if (sig->invalid)
+                            domain_key_valid = -2;
+                        if (uid->revoked || sig->revoked)
+                            domain_key_valid = -6;
+                        if (sig->status == GPG_ERR_NO_PUBKEY)
+                            domain_key_valid = -1;
+                        if (sig->status == GPG_ERR_GENERAL)
+                            domain_key_valid = -1;
+                        if (key)
+                            gpgme_key_unref (key);
+                        if (secret_key)
+                            gpgme_key_unref (secret_key);
+                    }
+                    if (!strcmp(sig->keyid, (char *) required_sig_keyid.c_str())){
+                        if (nuids == 0) {
+                            if (user_key && user_key->owner_trust == GPGME_VALIDITY_ULTIMATE)
+                                domain_key_valid = 4;
+                            if (user_key && user_key->owner_trust == GPGME_VALIDITY_FULL)
+                                domain_key_valid = 6;
+                            if (user_key && user_key->expired)
+                                domain_key_valid++;
+                            if (sig->expired)
+                                domain_key_valid = -6;
+                            if (sig->invalid)
+                                domain_key_valid = -2;
+                            if (uid->revoked || sig->revoked)
+                                domain_key_valid = -6;
+                            if (sig->status == GPG_ERR_NO_PUBKEY)
+                                domain_key_valid = -1;
+                            if (sig->status == GPG_ERR_GENERAL)
+                                domain_key_valid = -1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (domain_key)
+        gpgme_key_unref (domain_key);
+    if (user_key)
+        gpgme_key_unref (user_key);
+
+    return domain_key_valid;
+}
+
+// A key that may pass trust on to the keys it certifies
+inline bool trust_graph_introducer(const trust_key& key, gpgme_validity_t min_trust)
+{
+    return !key.revoked && !key.expired && !key.disabled && !key.invalid
+        && key.owner_trust >= min_trust && key.owner_trust <= GPGME_VALIDITY_ULTIMATE;
+}
+
+/*
+    Computes the validity that the PGP trust model of gpg gives every key.
+        A key with ultimate ownertrust is valid, and a UID becomes fully valid
+        when it is certified by a key with ultimate ownertrust, by
+        completes_needed fully valid keys with full ownertrust or by
+        marginals_needed fully valid keys with marginal ownertrust; with
+        fewer such certifications it is marginally valid. As in gpg the
+        certifications are counted per UID and a key has the validity of its
+        most valid UID. Only fully valid keys act as introducers, and keys
+        more than max_depth certifications away from an ultimately trusted
+        key are not made valid.
+
+    validity receives the validity of each key in graph.keys.
+*/
+inline void trust_graph_validity(const trust_graph& graph, int completes_needed,
+    int marginals_needed, int max_depth, std::vector<gpgme_validity_t>& validity)
+{
+    size_t nkeys = graph.keys.size();
+    std::vector<long> frontier, candidates, next, signers;
+    size_t i, j, k;
+
+    validity.assign(nkeys, GPGME_VALIDITY_UNKNOWN);
+
+    for (i = 0; i < nkeys; i++) {
+        if (graph.keys[i].owner_trust == GPGME_VALIDITY_ULTIMATE
+            && trust_graph_introducer(graph.keys[i], GPGME_VALIDITY_ULTIMATE)) {
+            validity[i] = GPGME_VALIDITY_ULTIMATE;
+            frontier.push_back(i);
+        }
+    }
+
+    for (int depth = 0; depth < max_depth && !frontier.empty(); depth++) {
+        // The keys certified by the introducers of the previous level
+        candidates.clear();
+        for (i = 0; i < frontier.size(); i++) {
+            const std::vector<long>& edges = graph.keys[frontier[i]].certifies;
+            for (j = 0; j < edges.size(); j++) {
+                if (validity[edges[j]] < GPGME_VALIDITY_FULL)
+                    candidates.push_back(edges[j]);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()),
+            candidates.end());
+
+        // Count only the introducers of the previous levels, so the result
+        //  does not depend on the order of the keys
+        next.clear();
+        for (i = 0; i < candidates.size(); i++) {
+            const trust_key& key = graph.keys[candidates[i]];
+            gpgme_validity_t key_validity = GPGME_VALIDITY_UNKNOWN;
+
+            for (j = 0; j < key.uids.size(); j++) {
+                const trust_uid& uid = key.uids[j];
+                int fulls = 0, marginals = 0;
+                bool ultimate = false;
+
+                signers.clear();
+                for (k = 0; k < uid.sigs.size(); k++) {
+                    if (trust_sig_usable(uid, uid.sigs[k], candidates[i]))
+                        signers.push_back(uid.sigs[k].signer);
+                }
+                trust_graph_unique(signers);
+
+                for (k = 0; k < signers.size(); k++) {
+                    const trust_key& signer = graph.keys[signers[k]];
+                    if (validity[signers[k]] < GPGME_VALIDITY_FULL
+                        || !trust_graph_introducer(signer, GPGME_VALIDITY_MARGINAL))
+                        continue;
+                    if (signer.owner_trust == GPGME_VALIDITY_ULTIMATE)
+                        ultimate = true;
+                    else if (signer.owner_trust == GPGME_VALIDITY_FULL)
+                        fulls++;
+                    else
+                        marginals++;
+                }
+
+                if (ultimate || fulls >= completes_needed || marginals >= marginals_needed)
+                    key_validity = GPGME_VALIDITY_FULL;
+                else if (fulls + marginals > 0 && key_validity < GPGME_VALIDITY_MARGINAL)
+                    key_validity = GPGME_VALIDITY_MARGINAL;
+            }
+
+            if (key_validity == GPGME_VALIDITY_FULL)
+                next.push_back(candidates[i]);
+            else if (key_validity == GPGME_VALIDITY_MARGINAL)
+                validity[candidates[i]] = GPGME_VALIDITY_MARGINAL;
+        }
+
+        for (i = 0; i < next.size(); i++)
+            validity[next[i]] = GPGME_VALIDITY_FULL;
+        frontier.swap(next);
+    }
+}
+
+// A key that passes trust on to the keys it certifies; see trust_graph_validity()
+inline bool trust_graph_valid_introducer(const trust_graph& graph,
+    const std::vector<gpgme_validity_t>& validity, long idx)
+{
+    return validity[idx] >= GPGME_VALIDITY_FULL
+        && trust_graph_introducer(graph.keys[idx], GPGME_VALIDITY_MARGINAL);
+}
+
+/*
+    Finds a shortest chain of certifications from an ultimately trusted key
+        to the key at target_idx in which every key but the target is an
+        introducer according to validity (see trust_graph_validity()), using a
+        breadth first search from both ends that always grows the smaller
+        frontier.
+
+    On success path holds the key indexes from the trusted key to the
+        target and true is returned.
+*/
+inline bool trust_graph_find_path(const trust_graph& graph, long target_idx,
+    int max_depth, const std::vector<gpgme_validity_t>& validity,
+    std::vector<long>& path)
+{
+    size_t nkeys = graph.keys.size();
+    std::vector<int> fwd_depth(nkeys, -1), bwd_depth(nkeys, -1);
+    std::vector<long> fwd_parent(nkeys, -1), bwd_parent(nkeys, -1);
+    std::vector<long> fwd_frontier, bwd_frontier, next;
+    int fwd_level = 0, bwd_level = 0;
+    long meet = -1;
+    int meet_len = 0;
+    size_t i, j;
+
+    path.clear();
+
+    for (i = 0; i < nkeys; i++) {
+        if (validity[i] == GPGME_VALIDITY_ULTIMATE) {
+            fwd_depth[i] = 0;
+            fwd_frontier.push_back(i);
+        }
+    }
+
+    if (fwd_depth[target_idx] == 0) {
+        path.push_back(target_idx);
+        return true;
+    }
+
+    bwd_depth[target_idx] = 0;
+    bwd_frontier.push_back(target_idx);
+
+    while (meet < 0 && fwd_level + bwd_level < max_depth
+        && !fwd_frontier.empty() && !bwd_frontier.empty()) {
+        next.clear();
+        if (fwd_frontier.size() <= bwd_frontier.size()) {
+            // Follow the certifications made by the keys reached so far
+            for (i = 0; i < fwd_frontier.size(); i++) {
+                const std::vector<long>& edges = graph.keys[fwd_frontier[i]].certifies;
+                for (j = 0; j < edges.size(); j++) {
+                    long v = edges[j];
+                    if (fwd_depth[v] >= 0)
+                        continue;
+                    if (bwd_depth[v] < 0 && !trust_graph_valid_introducer(graph, validity, v))
+                        continue;
+                    fwd_depth[v] = fwd_level + 1;
+                    fwd_parent[v] = fwd_frontier[i];
+                    if (bwd_depth[v] >= 0) {
+                        if (meet < 0 || fwd_depth[v] + bwd_depth[v] < meet_len) {
+                            meet = v;
+                            meet_len = fwd_depth[v] + bwd_depth[v];
+                        }
+                    } else {
+                        next.push_back(v);
+                    }
+                }
+            }
+            fwd_frontier.swap(next);
+            fwd_level++;
+        } else {
+            // Follow the certifications back to the keys that made them
+            for (i = 0; i < bwd_frontier.size(); i++) {
+                const std::vector<long>& edges = graph.keys[bwd_frontier[i]].certified_by;
+                for (j = 0; j < edges.size(); j++) {
+                    long v = edges[j];
+                    if (bwd_depth[v] >= 0)
+                        continue;
+                    if (!trust_graph_valid_introducer(graph, validity, v))
+                        continue;
+                    bwd_depth[v] = bwd_level + 1;
+                    bwd_parent[v] = bwd_frontier[i];
+                    if (fwd_depth[v] >= 0) {
+                        if (meet < 0 || fwd_depth[v] + bwd_depth[v] < meet_len) {
+                            meet = v;
+                            meet_len = fwd_depth[v] + bwd_depth[v];
+                        }
+                    } else {
+                        next.push_back(v);
+                    }
+                }
+            }
+            bwd_frontier.swap(next);
+            bwd_level++;
+        }
+    }
+
+    if (meet < 0)
+        return false;
+
+    for (long k = meet; k >= 0; k = fwd_parent[k])
+        path.insert(path.begin(), k);
+    for (long k = bwd_parent[meet]; k >= 0; k = bwd_parent[k])
+        path.push_back(k);
+
+    return true;
+}
+
+#endif // H_gpgAuthPluginTRUSTGRAPH